@@ -0,0 +1,814 @@
+#include "hash_map.h"
+#include "hash_set.h"
+#include "concurrent_hash_map.h"
+#include "snapshot_hash_map.h"
+#include "mapped_hash_table.h"
+#include "randomized_queue.h"
+#include "concurrent_randomized_queue.h"
+#include "sentinel_hash_map.h"
+#include "frozen_hash_table.h"
+#include <benchmark/benchmark.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef BENCH_HAVE_ABSL
+#include <absl/container/flat_hash_map.h>
+#include <absl/container/flat_hash_set.h>
+#endif
+
+// containers under test: every collision policy of HashMap/HashSet against
+// std::unordered_map and (when available) absl::flat_hash_map as the flat baseline
+
+template<class K, class V>
+using LinearMap = HashMap<K, V, LinearProbing>;
+template<class K, class V>
+using QuadraticMap = HashMap<K, V, QuadraticProbing>;
+template<class K, class V>
+using GroupMap = HashMap<K, V, GroupProbing>;
+template<class K, class V>
+using RobinHoodMap = HashMap<K, V, RobinHoodProbing>;
+template<class K, class V>
+using NodeMap = HashMap<K, V, LinearProbing, std::hash<K>, std::equal_to<K>, NodeStorage>;
+template<class K, class V>
+using PooledNodeMap = HashMap<K, V, LinearProbing, std::hash<K>, std::equal_to<K>, PooledNodeStorage>;
+template<class K, class V>
+using StdMap = std::unordered_map<K, V>;
+// integer keys only; the two largest values are reserved
+template<class K, class V>
+using SentinelMap = SentinelHashMap<K, V, K(~K(0)), K(~K(0) - 1)>;
+
+template<class K, class V>
+using InlineMap = HashMap<K, V, GroupProbing, std::hash<K>, std::equal_to<K>, FlatStorage, PowerOfTwoMasking,
+        NoStats, InlineBuffer<8>>;
+
+template<class K>
+using LinearSet = HashSet<K, LinearProbing>;
+template<class K>
+using QuadraticSet = HashSet<K, QuadraticProbing>;
+template<class K>
+using GroupSet = HashSet<K, GroupProbing>;
+template<class K>
+using RobinHoodSet = HashSet<K, RobinHoodProbing>;
+template<class K>
+using StdSet = std::unordered_set<K>;
+
+#ifdef BENCH_HAVE_ABSL
+template<class K, class V>
+using AbslMap = absl::flat_hash_map<K, V>;
+template<class K>
+using AbslSet = absl::flat_hash_set<K>;
+#endif
+
+// 256 bytes: copying or moving it is as expensive as a few cache lines
+struct LargeValue {
+    std::array<std::uint64_t, 32> data{};
+
+    LargeValue() = default;
+
+    LargeValue(std::uint64_t v) {
+        data.fill(v);
+    }
+};
+
+template<class K>
+K make_key(std::uint64_t v);
+
+template<>
+std::uint64_t make_key<std::uint64_t>(std::uint64_t v) {
+    return v;
+}
+
+// long enough to be heap allocated, as instrument or order ids usually are
+template<>
+std::string make_key<std::string>(std::uint64_t v) {
+    return "instrument-" + std::to_string(v) + "-XNAS";
+}
+
+template<class K>
+std::vector<K> random_keys(std::size_t n, std::uint64_t seed) {
+    std::mt19937_64 rnd(seed);
+    std::vector<K> keys;
+    keys.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        keys.push_back(make_key<K>(rnd()));
+    }
+    return keys;
+}
+
+template<class K>
+std::vector<K> sequential_keys(std::size_t n) {
+    std::vector<K> keys;
+    keys.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        keys.push_back(make_key<K>(i));
+    }
+    return keys;
+}
+
+// lookups go in random order, so large tables are not served by the prefetcher
+template<class K>
+std::vector<K> shuffled(std::vector<K> keys) {
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(42));
+    return keys;
+}
+
+template<class Map, class Keys>
+Map build(const Keys &keys) {
+    Map map;
+    for (const auto &k: keys) {
+        map[k] = typename Map::mapped_type(1);
+    }
+    return map;
+}
+
+template<class Map>
+void BM_Insert(benchmark::State &state) {
+    using K = typename Map::key_type;
+    auto keys = random_keys<K>(state.range(0), 1);
+    for (auto _: state) {
+        Map map;
+        for (const auto &k: keys) {
+            map.emplace(k, typename Map::mapped_type(1));
+        }
+        benchmark::DoNotOptimize(map.size());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+template<class Map>
+void BM_InsertSequential(benchmark::State &state) {
+    using K = typename Map::key_type;
+    auto keys = sequential_keys<K>(state.range(0));
+    for (auto _: state) {
+        Map map;
+        for (const auto &k: keys) {
+            map.emplace(k, typename Map::mapped_type(1));
+        }
+        benchmark::DoNotOptimize(map.size());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+template<class Map>
+void BM_LookupHit(benchmark::State &state) {
+    using K = typename Map::key_type;
+    auto keys = random_keys<K>(state.range(0), 1);
+    Map map = build<Map>(keys);
+    auto probes = shuffled(keys);
+    std::size_t i = 0;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(map.find(probes[i]));
+        if (++i == probes.size()) {
+            i = 0;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<class Map>
+void BM_LookupMiss(benchmark::State &state) {
+    using K = typename Map::key_type;
+    Map map = build<Map>(random_keys<K>(state.range(0), 1));
+    auto probes = random_keys<K>(state.range(0), 2);
+    std::size_t i = 0;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(map.find(probes[i]) == map.end());
+        if (++i == probes.size()) {
+            i = 0;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// the same lookups on freeze(map), against BM_LookupHit of Map
+template<class Map>
+void BM_FrozenLookupHit(benchmark::State &state) {
+    using K = typename Map::key_type;
+    auto keys = random_keys<K>(state.range(0), 1);
+    auto frozen = freeze(build<Map>(keys));
+    auto probes = shuffled(keys);
+    std::size_t i = 0;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(frozen.find(probes[i]));
+        if (++i == probes.size()) {
+            i = 0;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<class Map>
+void BM_FrozenLookupMiss(benchmark::State &state) {
+    using K = typename Map::key_type;
+    auto frozen = freeze(build<Map>(random_keys<K>(state.range(0), 1)));
+    auto probes = random_keys<K>(state.range(0), 2);
+    std::size_t i = 0;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(frozen.find(probes[i]) == frozen.end());
+        if (++i == probes.size()) {
+            i = 0;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// lookups straight from the pages of a saved Map, mapped back as View
+template<class Map, class View>
+void BM_MappedLookupHit(benchmark::State &state) {
+    using K = typename Map::key_type;
+    auto keys = random_keys<K>(state.range(0), 1);
+    auto path = std::filesystem::temp_directory_path() / "bench_mapped_table.bin";
+    {
+        std::ofstream out(path, std::ios::binary);
+        build<Map>(keys).save(out);
+    }
+    View view(path.string());
+    std::filesystem::remove(path);
+    auto probes = shuffled(keys);
+    std::size_t i = 0;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(view.find(probes[i]));
+        if (++i == probes.size()) {
+            i = 0;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// a packet's worth of keys at a time, through find_batch where the map has it
+template<class Map>
+void BM_LookupBatch(benchmark::State &state) {
+    using K = typename Map::key_type;
+    constexpr std::size_t batch = 32;
+    auto keys = random_keys<K>(state.range(0), 1);
+    Map map = build<Map>(keys);
+    auto probes = shuffled(keys);
+    probes.resize(probes.size() / batch * batch);
+    std::vector<typename Map::iterator> found(batch, map.end());
+    std::size_t i = 0;
+    for (auto _: state) {
+        auto first = probes.begin() + i;
+        if constexpr (requires { map.find_batch(first, first + batch, found.begin()); }) {
+            map.find_batch(first, first + batch, found.begin());
+        } else {
+            std::transform(first, first + batch, found.begin(), [&](const K &k) { return map.find(k); });
+        }
+        benchmark::DoNotOptimize(found.data());
+        if ((i += batch) == probes.size()) {
+            i = 0;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+
+// steady size, every step erases the oldest entry and inserts a new one,
+// like orders being placed and cancelled
+template<class Map>
+void BM_EraseChurn(benchmark::State &state) {
+    using K = typename Map::key_type;
+    std::size_t n = state.range(0);
+    auto keys = random_keys<K>(4 * n, 1);
+    Map map = build<Map>(std::vector<K>(keys.begin(), keys.begin() + n));
+    std::size_t oldest = 0;
+    std::size_t next = n;
+    for (auto _: state) {
+        map.erase(keys[oldest]);
+        map.emplace(keys[next], typename Map::mapped_type(1));
+        if (++oldest == keys.size()) {
+            oldest = 0;
+        }
+        if (++next == keys.size()) {
+            next = 0;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// a quarter of the entries expire at once, like stale orders swept in bulk
+template<class Map>
+void BM_EraseIf(benchmark::State &state) {
+    using K = typename Map::key_type;
+    auto keys = random_keys<K>(state.range(0), 1);
+    for (auto _: state) {
+        state.PauseTiming();
+        Map map = build<Map>(keys);
+        std::size_t i = 0;
+        state.ResumeTiming();
+        using std::erase_if;
+        benchmark::DoNotOptimize(erase_if(map, [&](const auto &) { return i++ % 4 == 0; }));
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+template<class Map>
+void BM_Iterate(benchmark::State &state) {
+    using K = typename Map::key_type;
+    Map map = build<Map>(random_keys<K>(state.range(0), 1));
+    for (auto _: state) {
+        std::size_t cnt = 0;
+        for (const auto &kv: map) {
+            benchmark::DoNotOptimize(&kv);
+            ++cnt;
+        }
+        benchmark::DoNotOptimize(cnt);
+    }
+    state.SetItemsProcessed(state.iterations() * map.size());
+}
+
+// full sweep of a table most of whose elements were erased since it grew
+template<class Map>
+void BM_IterateSparse(benchmark::State &state) {
+    using K = typename Map::key_type;
+    auto keys = random_keys<K>(state.range(0), 1);
+    Map map = build<Map>(keys);
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        if (i % 16 != 0) {
+            map.erase(keys[i]);
+        }
+    }
+    for (auto _: state) {
+        std::size_t cnt = 0;
+        for (const auto &kv: map) {
+            benchmark::DoNotOptimize(&kv);
+            ++cnt;
+        }
+        benchmark::DoNotOptimize(cnt);
+    }
+    state.SetItemsProcessed(state.iterations() * map.size());
+}
+
+// whole 4M entry table built from one batch, on range(0) threads; one thread
+// is the serial insert path
+template<class Map>
+void BM_BulkBuild(benchmark::State &state) {
+    using K = typename Map::key_type;
+    std::vector<typename Map::value_type> input;
+    for (const K &key: random_keys<K>(1 << 22, 1)) {
+        input.emplace_back(key, typename Map::mapped_type(1));
+    }
+    for (auto _: state) {
+        Map map;
+        map.parallel_insert(input.begin(), input.end(), state.range(0));
+        benchmark::DoNotOptimize(map.size());
+    }
+    state.SetItemsProcessed(state.iterations() * input.size());
+}
+
+template<class Map>
+void BM_Rehash(benchmark::State &state) {
+    using K = typename Map::key_type;
+    Map map = build<Map>(random_keys<K>(state.range(0), 1));
+    for (auto _: state) {
+        map.rehash(map.bucket_count() * 2);
+        state.PauseTiming();
+        map.rehash(0);
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * map.size());
+}
+
+template<class Set>
+void BM_SetInsert(benchmark::State &state) {
+    using K = typename Set::key_type;
+    auto keys = random_keys<K>(state.range(0), 1);
+    for (auto _: state) {
+        Set set;
+        for (const auto &k: keys) {
+            set.insert(k);
+        }
+        benchmark::DoNotOptimize(set.size());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+template<class Set>
+void BM_SetContains(benchmark::State &state) {
+    using K = typename Set::key_type;
+    auto keys = random_keys<K>(state.range(0), 1);
+    Set set(keys.begin(), keys.end());
+    auto probes = random_keys<K>(state.range(0), 2);
+    std::copy_n(keys.begin(), keys.size() / 2, probes.begin());
+    probes = shuffled(probes);
+    std::size_t i = 0;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(set.contains(probes[i]));
+        if (++i == probes.size()) {
+            i = 0;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// a large set against one 16 times smaller, half of whose keys it holds:
+// by hand, iterating the left operand and probing the other for each key
+// with every result insert growing the output, or with intersect/unite
+template<class Set, bool Algebra>
+void BM_SetIntersect(benchmark::State &state) {
+    using K = typename Set::key_type;
+    auto keys = random_keys<K>(state.range(0), 1);
+    Set large(keys.begin(), keys.end());
+    auto other = random_keys<K>(keys.size() / 16, 2);
+    std::copy_n(keys.begin(), other.size() / 2, other.begin());
+    Set small(other.begin(), other.end());
+    for (auto _: state) {
+        if constexpr (Algebra) {
+            benchmark::DoNotOptimize(intersect(large, small).size());
+        } else {
+            Set res;
+            for (const auto &k: large) {
+                if (small.contains(k)) {
+                    res.insert(k);
+                }
+            }
+            benchmark::DoNotOptimize(res.size());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+template<class Set, bool Algebra>
+void BM_SetUnite(benchmark::State &state) {
+    using K = typename Set::key_type;
+    auto keys = random_keys<K>(state.range(0), 1);
+    Set large(keys.begin(), keys.end());
+    auto other = random_keys<K>(keys.size() / 16, 2);
+    std::copy_n(keys.begin(), other.size() / 2, other.begin());
+    Set small(other.begin(), other.end());
+    for (auto _: state) {
+        if constexpr (Algebra) {
+            benchmark::DoNotOptimize(unite(small, large).size());
+        } else {
+            Set res(small);
+            for (const auto &k: large) {
+                res.insert(k);
+            }
+            benchmark::DoNotOptimize(res.size());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+// == of two equally sized sets: when they differ in one key the
+// fingerprint turns them down without walking either table, so that case
+// counts one item per comparison; equal ones, built in another insertion
+// order, are walked key by key
+template<class Set, bool Equal>
+void BM_SetEqual(benchmark::State &state) {
+    using K = typename Set::key_type;
+    auto keys = random_keys<K>(state.range(0), 1);
+    Set a(keys.begin(), keys.end());
+    if constexpr (Equal) {
+        std::shuffle(keys.begin(), keys.end(), std::mt19937_64(42));
+    } else {
+        keys[keys.size() / 2] = random_keys<K>(1, 2)[0];
+    }
+    Set b(keys.begin(), keys.end());
+    for (auto _: state) {
+        benchmark::DoNotOptimize(a == b);
+    }
+    state.SetItemsProcessed(Equal ? state.iterations() * keys.size() : state.iterations());
+}
+
+// a map built, queried and dropped with a handful of entries, the case
+// InlineBuffer keeps off the heap
+template<class Map>
+void BM_SmallMapShortLived(benchmark::State &state) {
+    using K = typename Map::key_type;
+    auto keys = random_keys<K>(state.range(0), 1);
+    for (auto _: state) {
+        Map map;
+        for (const auto &key: keys) {
+            map[key] = 1;
+        }
+        for (const auto &key: keys) {
+            benchmark::DoNotOptimize(map.find(key));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+    state.counters["bytes"] = sizeof(Map);
+}
+
+// HashMap behind one global mutex, the setup ConcurrentHashMap replaces
+template<class K, class V>
+class LockedMap {
+private:
+    mutable std::mutex lock_;
+    HashMap<K, V> map_;
+public:
+    void insert_or_assign(const K &key, const V &value) {
+        std::lock_guard lock(lock_);
+        map_.insert_or_assign(key, value);
+    }
+
+    bool contains(const K &key) const {
+        std::lock_guard lock(lock_);
+        return map_.contains(key);
+    }
+};
+
+// every thread of the benchmark works on the same map of 1M entries,
+// 95% lookups and 5% updates
+template<class Map>
+void BM_ConcurrentMix(benchmark::State &state) {
+    static constexpr std::size_t n = 1 << 20;
+    static const std::vector<std::uint64_t> keys = random_keys<std::uint64_t>(n, 1);
+    static Map map;
+    static const bool built = [] {
+        for (auto k: keys) {
+            map.insert_or_assign(k, 1);
+        }
+        return true;
+    }();
+    benchmark::DoNotOptimize(built);
+    std::mt19937_64 rnd(state.thread_index());
+    for (auto _: state) {
+        std::uint64_t r = rnd();
+        const auto &key = keys[r % n];
+        if ((r >> 32) % 20 == 0) {
+            map.insert_or_assign(key, r);
+        } else {
+            benchmark::DoNotOptimize(map.contains(key));
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// randomized_queue behind one global mutex, the setup
+// concurrent_randomized_queue replaces
+template<class T>
+class LockedQueue {
+private:
+    std::mutex lock_;
+    randomized_queue<T> queue_;
+public:
+    void enqueue(T item) {
+        std::lock_guard lock(lock_);
+        queue_.enqueue(std::move(item));
+    }
+
+    std::optional<T> try_dequeue() {
+        std::lock_guard lock(lock_);
+        if (queue_.empty()) {
+            return std::nullopt;
+        }
+        return queue_.dequeue();
+    }
+};
+
+// every thread of the benchmark hands work items to the same queue and takes
+// random ones back, one of each per iteration, over a backlog of 64K items
+template<class Queue>
+void BM_ConcurrentQueue(benchmark::State &state) {
+    static Queue queue;
+    if (state.thread_index() == 0) {
+        std::uint64_t backlog = (1 << 16) / static_cast<std::uint64_t>(state.threads());
+        for (std::uint64_t i = 0; i < backlog; ++i) {
+            queue.enqueue(i);
+        }
+    }
+    std::uint64_t item = state.thread_index();
+    for (auto _: state) {
+        queue.enqueue(item);
+        auto taken = queue.try_dequeue();
+        benchmark::DoNotOptimize(taken);
+        item = taken ? *taken : item;
+    }
+    if (state.thread_index() == 0) {
+        while (queue.try_dequeue()) {}
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// lookups only, by every thread at once: SnapshotHashMap readers against
+// the shared shard locks of ConcurrentHashMap
+template<class Map>
+void BM_SharedReads(benchmark::State &state) {
+    static constexpr std::size_t n = 1 << 20;
+    static const std::vector<std::uint64_t> keys = random_keys<std::uint64_t>(n, 1);
+    static Map map;
+    static const bool built = [] {
+        if constexpr (requires { map.assign(build<HashMap<std::uint64_t, std::uint64_t>>(keys)); }) {
+            map.assign(build<HashMap<std::uint64_t, std::uint64_t>>(keys));
+        } else {
+            for (auto k: keys) {
+                map.insert_or_assign(k, 1);
+            }
+        }
+        return true;
+    }();
+    benchmark::DoNotOptimize(built);
+    auto reader = [] {
+        if constexpr (requires { map.reader(); }) {
+            return map.reader();
+        } else {
+            return &map;
+        }
+    }();
+    std::mt19937_64 rnd(state.thread_index());
+    for (auto _: state) {
+        const auto &key = keys[rnd() % n];
+        if constexpr (std::is_pointer_v<decltype(reader)>) {
+            benchmark::DoNotOptimize(reader->contains(key));
+        } else {
+            benchmark::DoNotOptimize(reader.contains(key));
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// one whole traversal of the queue in random order
+template<class Queue>
+void BM_QueueIterate(benchmark::State &state) {
+    Queue queue;
+    for (std::uint64_t i = 0; i < static_cast<std::uint64_t>(state.range(0)); ++i) {
+        queue.enqueue(i);
+    }
+    for (auto _: state) {
+        std::uint64_t sum = 0;
+        for (auto v: queue) {
+            sum += v;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// a random element through begin(), what setting up a traversal costs
+template<class Queue>
+void BM_QueueFirst(benchmark::State &state) {
+    Queue queue;
+    for (std::uint64_t i = 0; i < static_cast<std::uint64_t>(state.range(0)); ++i) {
+        queue.enqueue(i);
+    }
+    for (auto _: state) {
+        benchmark::DoNotOptimize(*queue.begin());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// a short-lived queue: built, filled with a handful of ids, drained
+template<class Queue>
+void BM_QueueShortLived(benchmark::State &state) {
+    for (auto _: state) {
+        Queue queue;
+        for (std::uint64_t i = 0; i < 16; ++i) {
+            queue.enqueue(i);
+        }
+        while (!queue.empty()) {
+            benchmark::DoNotOptimize(queue.dequeue());
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// k random items pulled out of a 64K queue and put back, by dequeue_n or
+// by k dequeue() calls
+template<class Queue, bool Batch>
+void BM_QueueDequeueN(benchmark::State &state) {
+    Queue queue;
+    for (std::uint64_t i = 0; i < (1 << 16); ++i) {
+        queue.enqueue(make_key<typename Queue::value_type>(i));
+    }
+    std::vector<typename Queue::value_type> items(state.range(0));
+    for (auto _: state) {
+        if constexpr (Batch) {
+            queue.dequeue_n(items.size(), items.begin());
+        } else {
+            for (auto &item: items) {
+                item = queue.dequeue();
+            }
+        }
+        for (auto &item: items) {
+            queue.enqueue(std::move(item));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// from L1-resident (256 entries) up to DRAM-resident (4M entries)
+static void sizes(benchmark::internal::Benchmark *b) {
+    b->RangeMultiplier(8)->Range(1 << 8, 1 << 22);
+}
+
+// string keys and large values make every entry several times larger
+static void small_sizes(benchmark::internal::Benchmark *b) {
+    b->RangeMultiplier(8)->Range(1 << 8, 1 << 20);
+}
+
+#define BENCH_MAP(bench, map, key, value, range) \
+    BENCHMARK_TEMPLATE(bench, map<key, value>)->Apply(range);
+
+#ifdef BENCH_HAVE_ABSL
+#define BENCH_ABSL_MAP(bench, key, value, range) BENCH_MAP(bench, AbslMap, key, value, range)
+#define BENCH_ABSL_SET(bench, key, range) BENCHMARK_TEMPLATE(bench, AbslSet<key>)->Apply(range);
+#else
+#define BENCH_ABSL_MAP(bench, key, value, range)
+#define BENCH_ABSL_SET(bench, key, range)
+#endif
+
+#define BENCH_ALL_MAPS(bench, key, value, range) \
+    BENCH_MAP(bench, LinearMap, key, value, range) \
+    BENCH_MAP(bench, QuadraticMap, key, value, range) \
+    BENCH_MAP(bench, GroupMap, key, value, range) \
+    BENCH_MAP(bench, RobinHoodMap, key, value, range) \
+    BENCH_MAP(bench, NodeMap, key, value, range) \
+    BENCH_MAP(bench, PooledNodeMap, key, value, range) \
+    BENCH_MAP(bench, StdMap, key, value, range) \
+    BENCH_ABSL_MAP(bench, key, value, range)
+
+#define BENCH_ALL_SETS(bench, key, range) \
+    BENCHMARK_TEMPLATE(bench, LinearSet<key>)->Apply(range); \
+    BENCHMARK_TEMPLATE(bench, QuadraticSet<key>)->Apply(range); \
+    BENCHMARK_TEMPLATE(bench, GroupSet<key>)->Apply(range); \
+    BENCHMARK_TEMPLATE(bench, RobinHoodSet<key>)->Apply(range); \
+    BENCHMARK_TEMPLATE(bench, StdSet<key>)->Apply(range); \
+    BENCH_ABSL_SET(bench, key, range)
+
+using u64 = std::uint64_t;
+
+BENCH_ALL_MAPS(BM_Insert, u64, u64, sizes)
+BENCH_ALL_MAPS(BM_InsertSequential, u64, u64, sizes)
+BENCH_ALL_MAPS(BM_LookupHit, u64, u64, sizes)
+BENCH_ALL_MAPS(BM_LookupMiss, u64, u64, sizes)
+BENCH_ALL_MAPS(BM_LookupBatch, u64, u64, sizes)
+BENCH_ALL_MAPS(BM_EraseChurn, u64, u64, sizes)
+BENCH_ALL_MAPS(BM_EraseIf, u64, u64, sizes)
+BENCH_ALL_MAPS(BM_Iterate, u64, u64, sizes)
+BENCH_ALL_MAPS(BM_IterateSparse, u64, u64, sizes)
+BENCH_ALL_MAPS(BM_Rehash, u64, u64, sizes)
+BENCH_MAP(BM_Insert, SentinelMap, u64, u64, sizes)
+BENCH_MAP(BM_LookupHit, SentinelMap, u64, u64, sizes)
+BENCH_MAP(BM_LookupMiss, SentinelMap, u64, u64, sizes)
+BENCH_MAP(BM_EraseChurn, SentinelMap, u64, u64, sizes)
+BENCH_MAP(BM_Iterate, SentinelMap, u64, u64, sizes)
+
+BENCH_ALL_MAPS(BM_Insert, std::string, u64, small_sizes)
+BENCH_ALL_MAPS(BM_LookupHit, std::string, u64, small_sizes)
+BENCH_ALL_MAPS(BM_LookupMiss, std::string, u64, small_sizes)
+BENCH_ALL_MAPS(BM_LookupBatch, std::string, u64, small_sizes)
+
+BENCH_MAP(BM_FrozenLookupHit, LinearMap, u64, u64, sizes)
+BENCH_MAP(BM_FrozenLookupMiss, LinearMap, u64, u64, sizes)
+BENCH_MAP(BM_FrozenLookupHit, LinearMap, std::string, u64, small_sizes)
+BENCH_MAP(BM_FrozenLookupMiss, LinearMap, std::string, u64, small_sizes)
+
+BENCHMARK_TEMPLATE(BM_MappedLookupHit, LinearMap<u64, u64>, MappedHashMap<u64, u64, LinearProbing>)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_MappedLookupHit, GroupMap<u64, u64>, MappedHashMap<u64, u64, GroupProbing>)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_MappedLookupHit, RobinHoodMap<u64, u64>, MappedHashMap<u64, u64, RobinHoodProbing>)->Apply(sizes);
+
+BENCH_ALL_MAPS(BM_Insert, u64, LargeValue, small_sizes)
+BENCH_ALL_MAPS(BM_LookupHit, u64, LargeValue, small_sizes)
+BENCH_ALL_MAPS(BM_Rehash, u64, LargeValue, small_sizes)
+
+BENCHMARK_TEMPLATE(BM_BulkBuild, LinearMap<u64, u64>)->RangeMultiplier(2)->Range(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_BulkBuild, GroupMap<u64, u64>)->RangeMultiplier(2)->Range(1, 16)->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_SmallMapShortLived, GroupMap<u64, u64>)->DenseRange(2, 8, 3)->Arg(16);
+BENCHMARK_TEMPLATE(BM_SmallMapShortLived, InlineMap<u64, u64>)->DenseRange(2, 8, 3)->Arg(16);
+BENCHMARK_TEMPLATE(BM_SmallMapShortLived, StdMap<u64, u64>)->DenseRange(2, 8, 3)->Arg(16);
+
+BENCHMARK_TEMPLATE(BM_ConcurrentMix, ConcurrentHashMap<u64, u64>)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ConcurrentMix, LockedMap<u64, u64>)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SharedReads, SnapshotHashMap<u64, u64>)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SharedReads, ConcurrentHashMap<u64, u64>)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ConcurrentQueue, concurrent_randomized_queue<u64>)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ConcurrentQueue, LockedQueue<u64>)->ThreadRange(1, 16)->UseRealTime();
+
+BENCH_ALL_SETS(BM_SetInsert, u64, sizes)
+BENCH_ALL_SETS(BM_SetContains, u64, sizes)
+BENCH_ALL_SETS(BM_SetContains, std::string, small_sizes)
+BENCHMARK_TEMPLATE(BM_SetIntersect, LinearSet<u64>, true)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_SetIntersect, LinearSet<u64>, false)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_SetIntersect, GroupSet<std::string>, true)->Apply(small_sizes);
+BENCHMARK_TEMPLATE(BM_SetIntersect, GroupSet<std::string>, false)->Apply(small_sizes);
+BENCHMARK_TEMPLATE(BM_SetUnite, LinearSet<u64>, true)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_SetUnite, LinearSet<u64>, false)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_SetEqual, LinearSet<u64>, true)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_SetEqual, LinearSet<u64>, false)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_SetEqual, GroupSet<std::string>, true)->Apply(small_sizes);
+BENCHMARK_TEMPLATE(BM_SetEqual, GroupSet<std::string>, false)->Apply(small_sizes);
+
+BENCHMARK_TEMPLATE(BM_QueueIterate, randomized_queue<std::uint64_t>)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_QueueFirst, randomized_queue<std::uint64_t>)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_QueueShortLived, randomized_queue<std::uint64_t>);
+BENCHMARK_TEMPLATE(BM_QueueDequeueN, randomized_queue<std::uint64_t>, true)->RangeMultiplier(8)->Range(8, 512);
+BENCHMARK_TEMPLATE(BM_QueueDequeueN, randomized_queue<std::uint64_t>, false)->RangeMultiplier(8)->Range(8, 512);
+BENCHMARK_TEMPLATE(BM_QueueDequeueN, randomized_queue<std::uint64_t, std::vector<std::uint64_t>, std::mt19937>, true)
+        ->RangeMultiplier(8)->Range(8, 512);
+BENCHMARK_TEMPLATE(BM_QueueDequeueN, randomized_queue<std::uint64_t, std::vector<std::uint64_t>, std::mt19937>, false)
+        ->RangeMultiplier(8)->Range(8, 512);
+BENCHMARK_TEMPLATE(BM_QueueDequeueN, randomized_queue<std::string>, true)->RangeMultiplier(8)->Range(8, 512);
+BENCHMARK_TEMPLATE(BM_QueueDequeueN, randomized_queue<std::string>, false)->RangeMultiplier(8)->Range(8, 512);
+BENCHMARK_TEMPLATE(BM_QueueShortLived, randomized_queue<std::uint64_t, std::vector<std::uint64_t>, std::mt19937>);
+
+BENCHMARK_MAIN();
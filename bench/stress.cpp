@@ -0,0 +1,266 @@
+#include "hash_map.h"
+#include "sentinel_hash_map.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// stress and latency run over every collision policy: each table goes
+// through the same inserts, lookups and insert/erase churn as a
+// std::unordered_map, every result is compared with the reference one, and
+// every single operation is timed; prints p50 / p99 / p99.9 / max latency
+// per table, key distribution and operation, and exits with 1 on any
+// mismatch
+//
+// usage: stress [elements = 100000] [churn rounds = 4]
+
+using u64 = std::uint64_t;
+
+// identity hasher claiming to avalanche, so tables use it unmixed: keys
+// differing only above the mask all get the same home slot
+struct WeakHash {
+    using is_avalanching = void;
+
+    std::size_t operator()(u64 key) const noexcept {
+        return static_cast<std::size_t>(key);
+    }
+};
+
+template<class Hash>
+using LinearTable = HashMap<u64, u64, LinearProbing, Hash>;
+template<class Hash>
+using QuadraticTable = HashMap<u64, u64, QuadraticProbing, Hash>;
+template<class Hash>
+using GroupTable = HashMap<u64, u64, GroupProbing, Hash>;
+template<class Hash>
+using RobinHoodTable = HashMap<u64, u64, RobinHoodProbing, Hash>;
+template<class Hash>
+using IncrementalTable = HashMap<u64, u64, LinearProbing, Hash, std::equal_to<u64>, FlatStorage, PowerOfTwoMasking,
+        NoStats, IncrementalRehash<>>;
+template<class Hash>
+using SentinelLinearTable = SentinelHashMap<u64, u64, ~u64(0), ~u64(0) - 1, LinearProbing, Hash>;
+template<class Hash>
+using SentinelQuadraticTable = SentinelHashMap<u64, u64, ~u64(0), ~u64(0) - 1, QuadraticProbing, Hash>;
+
+using Clock = std::chrono::steady_clock;
+
+// cost of the two clock reads around an operation, taken off every sample
+std::int64_t timer_overhead() {
+    std::vector<std::int64_t> samples(10000);
+    for (auto &sample: samples) {
+        auto start = Clock::now();
+        sample = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    }
+    std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+    return samples[samples.size() / 2];
+}
+
+const std::int64_t overhead = timer_overhead();
+
+// latencies of one kind of operation, in nanoseconds
+class Latencies {
+private:
+    std::vector<std::uint32_t> samples_;
+
+public:
+    template<class F>
+    auto time(F &&f) {
+        auto start = Clock::now();
+        auto res = f();
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count() - overhead;
+        samples_.push_back(static_cast<std::uint32_t>(std::clamp<std::int64_t>(ns, 0, UINT32_MAX)));
+        return res;
+    }
+
+    void report(const char *table, const char *keys, const char *op) {
+        if (samples_.empty()) {
+            return;
+        }
+        std::sort(samples_.begin(), samples_.end());
+        auto at = [&](double q) {
+            return samples_[std::min(samples_.size() - 1, static_cast<std::size_t>(q * samples_.size()))];
+        };
+        std::printf("%-20s %-12s %-8s %9zu %7u %7u %7u %9u\n", table, keys, op, samples_.size(), at(0.5), at(0.99),
+                    at(0.999), samples_.back());
+    }
+};
+
+// `count` distinct keys of a distribution
+struct Distribution {
+    const char *name;
+    std::vector<u64> (*make)(std::size_t count);
+};
+
+std::vector<u64> random_keys(std::size_t count) {
+    std::mt19937_64 rnd(count);
+    std::unordered_set<u64> seen;
+    std::vector<u64> keys;
+    while (keys.size() < count) {
+        u64 key = rnd() >> 2;
+        if (seen.insert(key).second) {
+            keys.push_back(key);
+        }
+    }
+    return keys;
+}
+
+std::vector<u64> sequential_keys(std::size_t count) {
+    std::vector<u64> keys(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        keys[i] = i;
+    }
+    return keys;
+}
+
+// only high bits differ: a table masking an unmixed hash sends them all home to 0
+std::vector<u64> strided_keys(std::size_t count) {
+    std::vector<u64> keys(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        keys[i] = u64(i) << 24;
+    }
+    return keys;
+}
+
+int mismatches = 0;
+
+void mismatch(const char *table, const char *keys, const char *what, u64 key) {
+    if (++mismatches <= 20) {
+        std::printf("MISMATCH %s %s: %s of key %llu\n", table, keys, what, static_cast<unsigned long long>(key));
+    }
+}
+
+template<class Table>
+void run(const char *table_name, const Distribution &dist, std::size_t count, std::size_t rounds) {
+    // the first `count` keys go in first, the rest are looked up as misses
+    // and inserted by the churn
+    std::vector<u64> keys = dist.make(3 * count);
+    std::mt19937_64 rnd(7);
+    Latencies inserts, hits, misses, erases;
+    Table table;
+    std::unordered_map<u64, u64> reference;
+    std::vector<u64> live(keys.begin(), keys.begin() + count);
+    std::vector<u64> spare(keys.begin() + count, keys.end());
+    const char *name = dist.name;
+    bool threw = false;
+    try {
+        for (u64 key: live) {
+            bool inserted = inserts.time([&] { return table.try_emplace(key, key + 1).second; });
+            if (inserted != reference.try_emplace(key, key + 1).second) {
+                mismatch(table_name, name, "insert", key);
+            }
+        }
+        std::shuffle(live.begin(), live.end(), rnd);
+        for (u64 key: live) {
+            bool found = hits.time([&] {
+                auto it = table.find(key);
+                return it != table.end() && it->second == key + 1;
+            });
+            if (!found) {
+                mismatch(table_name, name, "hit", key);
+            }
+        }
+        for (std::size_t i = 0; i < count; ++i) {
+            u64 key = spare[i];
+            if (misses.time([&] { return table.find(key) != table.end(); })) {
+                mismatch(table_name, name, "miss", key);
+            }
+        }
+        // erase a random element, insert a random absent (possibly erased) key
+        for (std::size_t i = 0; i < rounds * count; ++i) {
+            std::size_t victim = rnd() % live.size();
+            u64 key = live[victim];
+            std::size_t erased = erases.time([&] { return table.erase(key); });
+            if (erased != reference.erase(key)) {
+                mismatch(table_name, name, "erase", key);
+            }
+            live[victim] = live.back();
+            live.pop_back();
+            spare.push_back(key);
+
+            std::size_t fresh = rnd() % spare.size();
+            key = spare[fresh];
+            bool inserted = inserts.time([&] { return table.try_emplace(key, key + 1).second; });
+            if (inserted != reference.try_emplace(key, key + 1).second) {
+                mismatch(table_name, name, "insert", key);
+            }
+            spare[fresh] = spare.back();
+            spare.pop_back();
+            live.push_back(key);
+        }
+    } catch (const std::exception &e) {
+        // still compared below, so whatever the throw lost shows up too
+        std::printf("%-20s %-12s threw after %zu inserts: %s\n", table_name, name, reference.size(), e.what());
+        mismatch(table_name, name, "exception", reference.size());
+        threw = true;
+    }
+    // full comparison, both ways
+    std::size_t seen = 0;
+    for (const auto &[key, value]: table) {
+        auto it = reference.find(key);
+        if (it == reference.end() || it->second != value) {
+            mismatch(table_name, name, "iteration", key);
+        }
+        ++seen;
+    }
+    for (const auto &[key, value]: reference) {
+        auto it = table.find(key);
+        if (it == table.end() || it->second != value) {
+            mismatch(table_name, name, "lookup", key);
+        }
+    }
+    if (seen != reference.size() || table.size() != reference.size()) {
+        mismatch(table_name, name, "size", seen);
+    }
+    if (threw) {
+        return;
+    }
+    inserts.report(table_name, name, "insert");
+    hits.report(table_name, name, "hit");
+    misses.report(table_name, name, "miss");
+    erases.report(table_name, name, "erase");
+}
+
+template<class Hash>
+void run_all(const Distribution &dist, std::size_t count, std::size_t rounds) {
+    run<LinearTable<Hash>>("linear", dist, count, rounds);
+    run<QuadraticTable<Hash>>("quadratic", dist, count, rounds);
+    run<GroupTable<Hash>>("group", dist, count, rounds);
+    run<RobinHoodTable<Hash>>("robin-hood", dist, count, rounds);
+    run<IncrementalTable<Hash>>("linear-incremental", dist, count, rounds);
+    run<SentinelLinearTable<Hash>>("sentinel-linear", dist, count, rounds);
+    run<SentinelQuadraticTable<Hash>>("sentinel-quadratic", dist, count, rounds);
+    run<std::unordered_map<u64, u64, Hash>>("std", dist, count, rounds);
+}
+
+int main(int argc, char **argv) {
+    std::size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000;
+    std::size_t rounds = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 4;
+    if (count == 0) {
+        std::fprintf(stderr, "usage: %s [elements] [churn rounds]\n", argv[0]);
+        return 2;
+    }
+    std::printf("timer overhead %lld ns, subtracted from every sample\n", static_cast<long long>(overhead));
+    std::printf("%-20s %-12s %-8s %9s %7s %7s %7s %9s\n", "table", "keys", "op", "count", "p50", "p99", "p99.9",
+                "max (ns)");
+    for (const Distribution &dist: {Distribution{"random", random_keys},
+                                    Distribution{"sequential", sequential_keys},
+                                    Distribution{"strided", strided_keys}}) {
+        run_all<std::hash<u64>>(dist, count, rounds);
+    }
+    // every key gets the same home slot: probing degenerates to a scan of
+    // one ever growing run, so the element count is kept small
+    run_all<WeakHash>(Distribution{"one-home", strided_keys}, std::min<std::size_t>(count, 2000), rounds);
+    if (mismatches != 0) {
+        std::printf("%d results differ from std::unordered_map\n", mismatches);
+        return 1;
+    }
+    std::puts("all results match std::unordered_map");
+    return 0;
+}
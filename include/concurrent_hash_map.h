@@ -0,0 +1,363 @@
+#pragma once
+
+#include "policy.h"
+#include "hash_table.h"
+#include "shared_spin_lock.h"
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// hash map for many threads: the keys are split by hash over a fixed number
+// of shards, each one a HashTable behind its own reader-writer lock, so
+// threads only contend when they hit the same shard.
+// Elements are only reached through visitors, called with the shard lock
+// held (shared for cvisit, exclusive otherwise), so no reference or
+// iterator can outlive its lock; visitors must not call back into the map
+template<
+        class Key,
+        class T,
+        class CollisionPolicy = LinearProbing,
+        class Hash = std::hash<Key>,
+        class Equal = std::equal_to<Key>,
+        class Storage = default_storage_t<Key, Hash>,
+        class IndexPolicy = PowerOfTwoMasking,
+        class SharedMutex = SharedSpinLock,
+        class Allocator = std::allocator<std::pair<const Key, T>>
+>
+class ConcurrentHashMap {
+public:
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<const Key, T>;
+    using size_type = std::size_t;
+    using hasher = Hash;
+    using key_equal = Equal;
+    using allocator_type = Allocator;
+
+private:
+    using Table = HashTable<Key, value_type, SelectFirst, CollisionPolicy, Hash, Equal, Storage, IndexPolicy,
+            NoStats, Allocator>;
+    using slot_type = typename Table::slot_type;
+
+    // a cache line of its own, so that locking one shard doesn't slow down
+    // threads working on the neighbouring one
+    struct alignas(64) Shard {
+        mutable SharedMutex lock;
+        Table table;
+
+        Shard(size_type expected_max_size, const hasher &hash, const key_equal &equal,
+              const allocator_type &alloc) : table(expected_max_size, hash, equal, SelectFirst(), alloc) {}
+    };
+
+    static constexpr bool transparent_lookup = Table::transparent_lookup;
+
+    static constexpr size_type max_shard_bits_ = 16;
+
+    // four shards per hardware thread keep the chance of two threads
+    // meeting in the same shard low
+    static size_type default_shard_count() {
+        return std::max<size_type>(std::thread::hardware_concurrency(), 1) * 4;
+    }
+
+    static size_type shard_bits_for(size_type shard_count) {
+        return std::min<size_type>(std::countr_zero(std::bit_ceil(std::max<size_type>(shard_count, 1))),
+                                   max_shard_bits_);
+    }
+
+public:
+    // `shard_count` is rounded up to a power of two, at most 2^16
+    explicit ConcurrentHashMap(size_type expected_max_size = 0,
+                               size_type shard_count = default_shard_count(),
+                               const hasher &hash = hasher(),
+                               const key_equal &equal = key_equal(),
+                               const allocator_type &alloc = allocator_type()) : shard_bits_(
+            shard_bits_for(shard_count)) {
+        for (size_type i = 0; i < (size_type(1) << shard_bits_); ++i) {
+            shards_.emplace_back(expected_max_size >> shard_bits_, hash, equal, alloc);
+        }
+    }
+
+    explicit ConcurrentHashMap(const allocator_type &alloc) : ConcurrentHashMap(0, default_shard_count(), hasher(),
+                                                                                key_equal(), alloc) {}
+
+    ConcurrentHashMap(const ConcurrentHashMap &) = delete;
+
+    ConcurrentHashMap &operator=(const ConcurrentHashMap &) = delete;
+
+    // not a snapshot: shards are counted one after another
+    size_type size() const {
+        size_type res = 0;
+        for (const Shard &shard: shards_) {
+            std::shared_lock lock(shard.lock);
+            res += shard.table.size();
+        }
+        return res;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_type shard_count() const {
+        return shards_.size();
+    }
+
+    allocator_type get_allocator() const {
+        return shards_.front().table.get_allocator();
+    }
+
+    void clear() {
+        for (Shard &shard: shards_) {
+            std::unique_lock lock(shard.lock);
+            shard.table.clear();
+        }
+    }
+
+    void reserve(size_type count) {
+        for (Shard &shard: shards_) {
+            std::unique_lock lock(shard.lock);
+            shard.table.reserve((count >> shard_bits_) + 1);
+        }
+    }
+
+    // all of the following return whether an element was inserted
+
+    bool insert(const value_type &value) {
+        return emplace_key(value.first, value);
+    }
+
+    bool insert(value_type &&value) {
+        return emplace_key(value.first, std::move(value));
+    }
+
+    template<class... Args>
+    bool emplace(Args &&... args) {
+        // the key is only known once the element exists; it is built outside
+        // of any lock and moved into its shard
+        value_type tmp(std::forward<Args>(args)...);
+        return emplace_key(tmp.first, std::move(tmp));
+    }
+
+    template<class... Args>
+    bool try_emplace(const key_type &key, Args &&... args) {
+        return emplace_key(key, std::piecewise_construct, std::forward_as_tuple(key),
+                           std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+
+    template<class... Args>
+    bool try_emplace(key_type &&key, Args &&... args) {
+        return emplace_key(key, std::piecewise_construct, std::forward_as_tuple(std::move(key)),
+                           std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+
+    template<class M>
+    bool insert_or_assign(const key_type &key, M &&value) {
+        return emplace_key_and_visit(key, [&](value_type &v, bool inserted) {
+            if (!inserted) {
+                v.second = std::forward<M>(value);
+            }
+        }, key, std::forward<M>(value));
+    }
+
+    template<class M>
+    bool insert_or_assign(key_type &&key, M &&value) {
+        return emplace_key_and_visit(key, [&](value_type &v, bool inserted) {
+            if (!inserted) {
+                v.second = std::forward<M>(value);
+            }
+        }, std::move(key), std::forward<M>(value));
+    }
+
+    // inserts `key` with a value built from `args` unless it is present,
+    // then calls `f(value_type &)` on the element either way, under the same lock
+    template<class F, class... Args>
+    bool try_emplace_and_visit(const key_type &key, F &&f, Args &&... args) {
+        return emplace_key_and_visit(key, [&](value_type &v, bool) { f(v); }, std::piecewise_construct,
+                                     std::forward_as_tuple(key),
+                                     std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+
+    template<class F, class... Args>
+    bool try_emplace_and_visit(key_type &&key, F &&f, Args &&... args) {
+        return emplace_key_and_visit(key, [&](value_type &v, bool) { f(v); }, std::piecewise_construct,
+                                     std::forward_as_tuple(std::move(key)),
+                                     std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+
+    // calls `f(value_type &)` on the element with `key` if there is one;
+    // returns the number of elements visited
+    template<class F>
+    size_type visit(const key_type &key, F &&f) {
+        return visit_impl(*this, key, f);
+    }
+
+    template<class K, class F>
+    requires transparent_lookup
+    size_type visit(const K &key, F &&f) {
+        return visit_impl(*this, key, f);
+    }
+
+    // `f(const value_type &)`, with other readers of the shard let in
+    template<class F>
+    size_type cvisit(const key_type &key, F &&f) const {
+        return visit_impl(*this, key, f);
+    }
+
+    template<class K, class F>
+    requires transparent_lookup
+    size_type cvisit(const K &key, F &&f) const {
+        return visit_impl(*this, key, f);
+    }
+
+    // visits every element, one shard at a time
+    template<class F>
+    size_type visit_all(F &&f) {
+        return visit_all_impl(*this, f);
+    }
+
+    template<class F>
+    size_type cvisit_all(F &&f) const {
+        return visit_all_impl(*this, f);
+    }
+
+    size_type count(const key_type &key) const {
+        return cvisit(key, [](const value_type &) {});
+    }
+
+    template<class K>
+    requires transparent_lookup
+    size_type count(const K &key) const {
+        return cvisit(key, [](const value_type &) {});
+    }
+
+    bool contains(const key_type &key) const {
+        return count(key) != 0;
+    }
+
+    template<class K>
+    requires transparent_lookup
+    bool contains(const K &key) const {
+        return count(key) != 0;
+    }
+
+    size_type erase(const key_type &key) {
+        return erase_key_if(key, [](const value_type &) { return true; });
+    }
+
+    template<class K>
+    requires transparent_lookup
+    size_type erase(const K &key) {
+        return erase_key_if(key, [](const value_type &) { return true; });
+    }
+
+    // erases the element with `key` if `pred(value_type &)` holds for it
+    template<class Pred>
+    size_type erase_if(const key_type &key, Pred &&pred) {
+        return erase_key_if(key, pred);
+    }
+
+    // erases every element `pred(value_type &)` holds for, one shard at a
+    // time, each in a single sweep of its slots
+    template<class Pred>
+    size_type erase_if(Pred &&pred) {
+        size_type res = 0;
+        for (Shard &shard: shards_) {
+            std::unique_lock lock(shard.lock);
+            res += shard.table.erase_if(pred);
+        }
+        return res;
+    }
+
+private:
+    // every shard hashes the same way; the hash is computed once, before
+    // its shard is locked
+    template<class K>
+    size_type hash_of(const K &key) const {
+        return shards_.front().table.hash_of(key);
+    }
+
+    size_type shard_of(size_type hash) const {
+        constexpr size_type bits = sizeof(size_type) * 8;
+        return shard_bits_ == 0 ? 0 : (hash << 7) >> (bits - shard_bits_);
+    }
+
+    template<class K, class... Args>
+    bool emplace_key(const K &key, Args &&... args) {
+        return emplace_key_and_visit(key, [](value_type &, bool) {}, std::forward<Args>(args)...);
+    }
+
+    // `f(element, whether it was just inserted)`
+    template<class K, class F, class... Args>
+    bool emplace_key_and_visit(const K &key, F &&f, Args &&... args) {
+        size_type hash = hash_of(key);
+        Shard &shard = shards_[shard_of(hash)];
+        std::unique_lock lock(shard.lock);
+        auto [id, inserted] = shard.table.insert_with(key, hash, [&](slot_type &slot) {
+            slot.construct(shard.table.alloc_, std::forward<Args>(args)...);
+        });
+        f(*shard.table.slots_[id].get(), inserted);
+        return inserted;
+    }
+
+    template<class Self, class K, class F>
+    static size_type visit_impl(Self &self, const K &key, F &f) {
+        size_type hash = self.hash_of(key);
+        auto &shard = self.shards_[self.shard_of(hash)];
+        auto lock = lock_for<Self>(shard.lock);
+        size_type id = shard.table.find_index(key, hash);
+        if (id == Table::npos) {
+            return 0;
+        }
+        f(*shard.table.slots_[id].get());
+        return 1;
+    }
+
+    template<class Self, class F>
+    static size_type visit_all_impl(Self &self, F &f) {
+        size_type res = 0;
+        for (auto &shard: self.shards_) {
+            auto lock = lock_for<Self>(shard.lock);
+            for (auto &value: shard.table) {
+                f(value);
+                ++res;
+            }
+        }
+        return res;
+    }
+
+    // shared lock for const visits, exclusive otherwise
+    template<class Self>
+    static auto lock_for(SharedMutex &mutex) {
+        if constexpr (std::is_const_v<Self>) {
+            return std::shared_lock(mutex);
+        } else {
+            return std::unique_lock(mutex);
+        }
+    }
+
+    template<class K, class Pred>
+    size_type erase_key_if(const K &key, Pred &&pred) {
+        size_type hash = hash_of(key);
+        Shard &shard = shards_[shard_of(hash)];
+        std::unique_lock lock(shard.lock);
+        size_type id = shard.table.find_index(key, hash);
+        if (id == Table::npos || !pred(*shard.table.slots_[id].get())) {
+            return 0;
+        }
+        shard.table.erase_at(id, hash);
+        return 1;
+    }
+
+    size_type shard_bits_;
+    // shards never move, a deque builds them in place
+    std::deque<Shard> shards_;
+};
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "randomized_queue.h"
+#include "shared_spin_lock.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// randomized_queue for many producers and consumers: every thread enqueues
+// into a shard of its own, a randomized_queue behind its own lock, and
+// dequeues a random element of that shard; a thread whose shard is empty
+// steals a random half of another, non-empty shard picked at random, so work
+// spreads back over the consumers and threads only meet while stealing.
+// Every dequeue is uniform over the shard it comes from, and over the whole
+// queue as far as the shards stay balanced; there is no global order to
+// keep uniform, which is what lets it scale.
+// Threads are dealt shards round-robin on their first call, several threads
+// per shard once there are more of them than shards
+template<class T, typename Container = std::vector<T>, class Engine = wyrand, class Mutex = SharedSpinLock>
+class concurrent_randomized_queue {
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using queue_type = randomized_queue<T, Container, Engine>;
+    using allocator_type = typename queue_type::allocator_type;
+
+private:
+    // a cache line of its own, so that locking one shard doesn't slow down
+    // threads working on the neighbouring one
+    struct alignas(64) Shard {
+        Mutex lock;
+        queue_type queue;
+        // kept up to date under the lock, read without it to skip empty shards
+        std::atomic<size_type> size{0};
+
+        explicit Shard(const allocator_type &alloc) : queue(alloc) {}
+    };
+
+    // stealing moves at most this many elements, to bound the time it holds
+    // the victim's lock
+    static constexpr size_type max_steal = 1024;
+
+    static size_type default_shard_count() {
+        return std::max<size_type>(std::thread::hardware_concurrency(), 1);
+    }
+
+    // the same for every queue: a thread keeps its shard index everywhere
+    static size_type thread_slot() {
+        static std::atomic<size_type> next_slot{0};
+        thread_local size_type slot = next_slot.fetch_add(1, std::memory_order_relaxed);
+        return slot;
+    }
+
+    static wyrand &thread_rnd() {
+        thread_local wyrand rnd([] {
+            std::random_device device;
+            return uint64_t(device()) << 32 | device();
+        }());
+        return rnd;
+    }
+
+public:
+    // `shard_count` is rounded up to a power of two
+    explicit concurrent_randomized_queue(size_type shard_count = default_shard_count(),
+                                         const allocator_type &alloc = allocator_type()) : mask(
+            std::bit_ceil(std::max<size_type>(shard_count, 1)) - 1) {
+        for (size_type i = 0; i <= mask; ++i) {
+            shards.emplace_back(alloc);
+        }
+    }
+
+    explicit concurrent_randomized_queue(const allocator_type &alloc) : concurrent_randomized_queue(
+            default_shard_count(), alloc) {}
+
+    concurrent_randomized_queue(const concurrent_randomized_queue &) = delete;
+
+    concurrent_randomized_queue &operator=(const concurrent_randomized_queue &) = delete;
+
+    // not a snapshot: shards are counted one after another
+    size_type size() const {
+        size_type res = 0;
+        for (const Shard &shard: shards) {
+            res += shard.size.load(std::memory_order_relaxed);
+        }
+        return res;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_type shard_count() const {
+        return shards.size();
+    }
+
+    allocator_type get_allocator() const {
+        return shards.front().queue.get_allocator();
+    }
+
+    void enqueue(const T &item) {
+        Shard &shard = local_shard();
+        std::lock_guard lock(shard.lock);
+        shard.queue.enqueue(T(item));
+        shard.size.store(shard.queue.size(), std::memory_order_relaxed);
+    }
+
+    void enqueue(T &&item) {
+        Shard &shard = local_shard();
+        std::lock_guard lock(shard.lock);
+        shard.queue.enqueue(std::move(item));
+        shard.size.store(shard.queue.size(), std::memory_order_relaxed);
+    }
+
+    // a random element of this thread's shard, or of a shard it steals from;
+    // empty when every other shard was found empty too, which elements
+    // in the middle of being stolen by another thread can make spurious
+    std::optional<T> try_dequeue() {
+        Shard &local = local_shard();
+        if (auto res = take(local)) {
+            return res;
+        }
+        size_type start = static_cast<size_type>(thread_rnd()()) & mask;
+        for (size_type i = 0; i <= mask; ++i) {
+            Shard &victim = shards[(start + i) & mask];
+            if (&victim != &local && victim.size.load(std::memory_order_relaxed) != 0) {
+                if (auto res = steal(victim, local)) {
+                    return res;
+                }
+            }
+        }
+        return std::nullopt;
+    }
+
+private:
+    Shard &local_shard() {
+        return shards[thread_slot() & mask];
+    }
+
+    static std::optional<T> take(Shard &shard) {
+        if (shard.size.load(std::memory_order_relaxed) == 0) {
+            return std::nullopt;
+        }
+        std::lock_guard lock(shard.lock);
+        if (shard.queue.empty()) {
+            return std::nullopt;
+        }
+        std::optional<T> res(shard.queue.dequeue());
+        shard.size.store(shard.queue.size(), std::memory_order_relaxed);
+        return res;
+    }
+
+    // takes a random half of the victim's elements (rounded up) in one
+    // dequeue_n, returns one of them and moves the rest into `local`; the two
+    // locks are never held together
+    static std::optional<T> steal(Shard &victim, Shard &local) {
+        thread_local std::vector<T> loot;
+        loot.clear();
+        {
+            std::lock_guard lock(victim.lock);
+            size_type count = std::min(victim.queue.size() - victim.queue.size() / 2, max_steal);
+            victim.queue.dequeue_n(count, std::back_inserter(loot));
+            victim.size.store(victim.queue.size(), std::memory_order_relaxed);
+        }
+        if (loot.empty()) {
+            return std::nullopt;
+        }
+        std::optional<T> res(std::move(loot.back()));
+        loot.pop_back();
+        if (!loot.empty()) {
+            std::lock_guard lock(local.lock);
+            for (T &item: loot) {
+                local.queue.enqueue(std::move(item));
+            }
+            local.size.store(local.queue.size(), std::memory_order_relaxed);
+        }
+        loot.clear();
+        return res;
+    }
+
+    size_type mask;
+    // shards never move, a deque builds them in place
+    std::deque<Shard> shards;
+};
@@ -0,0 +1,392 @@
+#pragma once
+
+#include "policy.h"
+#include "hash_map.h"
+#include "hash_set.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// constexpr hasher for tables built at compile time: integers and enums are
+// passed through (the table mixes them), strings are hashed as FNV-1a of
+// their bytes
+struct FrozenHash {
+    using is_transparent = void;
+
+    template<class T>
+    requires (std::is_integral_v<T> || std::is_enum_v<T>)
+    constexpr std::size_t operator()(T value) const noexcept {
+        return static_cast<std::size_t>(value);
+    }
+
+    constexpr std::size_t operator()(std::string_view str) const noexcept {
+        constexpr bool wide = sizeof(std::size_t) == 8;
+        std::size_t hash = wide ? std::size_t(0xcbf29ce484222325ull) : std::size_t(0x811c9dc5u);
+        for (char c: str) {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= wide ? std::size_t(0x100000001b3ull) : std::size_t(0x01000193u);
+        }
+        return hash;
+    }
+};
+
+// immutable table over a fixed set of distinct keys, laid out by a minimal
+// perfect hash (hash and displace): keys are split into buckets by their
+// hash, and every bucket gets a pilot value that sends all its keys to
+// slots no other key took, so the `n` elements fill exactly `n` slots.
+// A lookup hashes the key once, reads its bucket's pilot and compares one
+// key; for keys with slow hashers (see is_fast_hash_v) every slot's hash is
+// kept as well and compared first, so misses don't touch the key. With `N`
+// given, the elements are kept in std::arrays and the whole table can be
+// built in a constant expression; with std::dynamic_extent they are kept in
+// vectors and built at runtime, e.g. by freeze(HashMap).
+// Tables of more than 2^(bits of size_t / 2) elements are not supported
+template<
+        class Key,
+        class Value,
+        class KeyOf,
+        std::size_t N = std::dynamic_extent,
+        class Hash = FrozenHash,
+        class Equal = std::equal_to<>
+>
+class FrozenHashTable {
+public:
+    // types
+    using key_type = Key;
+    using value_type = Value;
+    using hasher = Hash;
+    using key_equal = Equal;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using reference = const value_type &;
+    using const_reference = const value_type &;
+    using pointer = const value_type *;
+    using const_pointer = const value_type *;
+    using iterator = const value_type *;
+    using const_iterator = const value_type *;
+
+private:
+    using pilot_type = std::uint32_t;
+
+    static constexpr bool fixed_ = N != std::dynamic_extent;
+
+    static constexpr bool cached_hash_ = !is_fast_hash_v<Key, Hash> &&
+                                         !(std::is_scalar_v<Key> && std::is_same_v<Hash, FrozenHash>);
+
+    // about two keys per bucket, the largest buckets get placed while most
+    // slots are still free
+    static constexpr size_type bucket_count_for(size_type count) {
+        return count / 2 + 1;
+    }
+
+    template<class T, size_type M>
+    using array_type = std::conditional_t<fixed_, std::array<T, M>, std::vector<T>>;
+
+    // both hasher and key_equal declare `is_transparent`, see HashTable
+    static constexpr bool transparent_lookup = requires {
+        typename Hash::is_transparent;
+        typename Equal::is_transparent;
+    };
+
+public:
+    // builds the table of the values in [first, last), whose keys must be
+    // distinct (std::invalid_argument otherwise); with a fixed `N` there
+    // must be exactly `N` of them (std::length_error otherwise)
+    template<class InputIt>
+    constexpr FrozenHashTable(InputIt first, InputIt last,
+                              const hasher &hash = hasher(),
+                              const key_equal &equal = key_equal()) : hash_(hash), equal_(equal) {
+        build(std::vector<value_type>(first, last));
+    }
+
+    constexpr FrozenHashTable(std::initializer_list<value_type> init,
+                              const hasher &hash = hasher(),
+                              const key_equal &equal = key_equal()) : FrozenHashTable(init.begin(), init.end(),
+                                                                                      hash, equal) {}
+
+    constexpr const_iterator begin() const noexcept {
+        return slots_.data();
+    }
+
+    constexpr const_iterator cbegin() const noexcept {
+        return begin();
+    }
+
+    constexpr const_iterator end() const noexcept {
+        return slots_.data() + slots_.size();
+    }
+
+    constexpr const_iterator cend() const noexcept {
+        return end();
+    }
+
+    constexpr bool empty() const noexcept {
+        return slots_.empty();
+    }
+
+    constexpr size_type size() const noexcept {
+        return slots_.size();
+    }
+
+    constexpr size_type bucket_count() const noexcept {
+        return pilots_.size();
+    }
+
+    constexpr const_iterator find(const key_type &key) const {
+        return find_key(key);
+    }
+
+    template<class K>
+    requires transparent_lookup
+    constexpr const_iterator find(const K &key) const {
+        return find_key(key);
+    }
+
+    constexpr bool contains(const key_type &key) const {
+        return find(key) != end();
+    }
+
+    template<class K>
+    requires transparent_lookup
+    constexpr bool contains(const K &key) const {
+        return find(key) != end();
+    }
+
+    constexpr size_type count(const key_type &key) const {
+        return contains(key);
+    }
+
+    template<class K>
+    requires transparent_lookup
+    constexpr size_type count(const K &key) const {
+        return contains(key);
+    }
+
+    // mapped value of `key`, for maps only
+    constexpr const auto &at(const key_type &key) const requires std::is_same_v<KeyOf, SelectFirst> {
+        return at_key(key);
+    }
+
+    template<class K>
+    requires (transparent_lookup && std::is_same_v<KeyOf, SelectFirst>)
+    constexpr const auto &at(const K &key) const {
+        return at_key(key);
+    }
+
+    // same elements, slot order aside
+    friend constexpr bool operator==(const FrozenHashTable &lhs, const FrozenHashTable &rhs) {
+        if (lhs.size() != rhs.size()) {
+            return false;
+        }
+        for (const value_type &value: lhs) {
+            const_iterator it = rhs.find(KeyOf()(value));
+            if (it == rhs.end() || !(*it == value)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    static constexpr size_type half_bits_ = sizeof(size_type) * 4;
+
+    // maps `hash` to [0, count) by its top bits, count < 2^half_bits_
+    static constexpr size_type reduce(size_type hash, size_type count) {
+        return (hash >> half_bits_) * count >> half_bits_;
+    }
+
+    template<class K>
+    constexpr size_type hash_of(const K &key) const {
+        if constexpr (is_avalanching_v<hasher>) {
+            return hash_(key);
+        } else {
+            return mix_hash(hash_(key));
+        }
+    }
+
+    // slot of a key of `hash`, given its bucket's pilot; `hash` is mixed
+    // already, one multiplication carries its low bits (which the bucket
+    // didn't use) up to the ones reduce() keeps
+    constexpr size_type slot_for(size_type hash, pilot_type pilot) const {
+        constexpr size_type golden = sizeof(size_type) == 8 ? size_type(0x9e3779b97f4a7c15ull)
+                                                            : size_type(0x9e3779b9u);
+        return reduce((hash ^ (pilot * golden)) * golden, size());
+    }
+
+    template<class K>
+    constexpr const_iterator find_key(const K &key) const {
+        if (empty()) {
+            return end();
+        }
+        size_type hash = hash_of(key);
+        size_type id = slot_for(hash, pilots_[reduce(hash, bucket_count())]);
+        if constexpr (cached_hash_) {
+            if (hashes_[id] != hash) {
+                return end();
+            }
+        }
+        return equal_(KeyOf()(slots_[id]), key) ? &slots_[id] : end();
+    }
+
+    template<class K>
+    constexpr const auto &at_key(const K &key) const {
+        const_iterator it = find_key(key);
+        if (it == end()) {
+            throw std::out_of_range("FrozenHashTable: no such key");
+        }
+        return it->second;
+    }
+
+    constexpr void build(std::vector<value_type> values) {
+        size_type count = values.size();
+        if (fixed_ && count != N) {
+            throw std::length_error("FrozenHashTable: expected exactly N values");
+        }
+        if (count >= size_type(1) << half_bits_) {
+            throw std::length_error("FrozenHashTable: too many values");
+        }
+        size_type buckets = bucket_count_for(count);
+        if constexpr (!fixed_) {
+            slots_.resize(count);
+            pilots_.resize(buckets);
+            if constexpr (cached_hash_) {
+                hashes_.resize(count);
+            }
+        }
+        std::vector<size_type> hashes(count);
+        std::vector<size_type> bucket_of(count);
+        std::vector<size_type> bucket_size(buckets);
+        for (size_type i = 0; i < count; ++i) {
+            hashes[i] = hash_of(KeyOf()(values[i]));
+            bucket_of[i] = reduce(hashes[i], buckets);
+            ++bucket_size[bucket_of[i]];
+        }
+        // keys of equal hashes can't be told apart by any pilot
+        std::vector<size_type> order(count);
+        std::iota(order.begin(), order.end(), size_type(0));
+        std::sort(order.begin(), order.end(), [&](size_type a, size_type b) { return hashes[a] < hashes[b]; });
+        for (size_type i = 1; i < count; ++i) {
+            if (hashes[order[i - 1]] == hashes[order[i]]) {
+                throw std::invalid_argument(equal_(KeyOf()(values[order[i - 1]]), KeyOf()(values[order[i]]))
+                                            ? "FrozenHashTable: duplicate key"
+                                            : "FrozenHashTable: distinct keys of equal hashes");
+            }
+        }
+        // largest buckets first, each bucket's keys next to each other
+        std::sort(order.begin(), order.end(), [&](size_type a, size_type b) {
+            if (bucket_size[bucket_of[a]] != bucket_size[bucket_of[b]]) {
+                return bucket_size[bucket_of[a]] > bucket_size[bucket_of[b]];
+            }
+            return bucket_of[a] < bucket_of[b];
+        });
+        // value placed in every slot, count while still free
+        std::vector<size_type> placed(count, count);
+        for (size_type first = 0; first < count;) {
+            size_type bucket = bucket_of[order[first]];
+            size_type last = first + bucket_size[bucket];
+            pilot_type pilot = 0;
+            for (;; ++pilot) {
+                size_type taken = first;
+                for (; taken < last; ++taken) {
+                    size_type id = slot_for(hashes[order[taken]], pilot);
+                    if (placed[id] != count) {
+                        break;
+                    }
+                    placed[id] = order[taken];
+                }
+                if (taken == last) {
+                    break;
+                }
+                for (size_type i = first; i < taken; ++i) {
+                    placed[slot_for(hashes[order[i]], pilot)] = count;
+                }
+                if (pilot == std::numeric_limits<pilot_type>::max()) {
+                    throw std::invalid_argument("FrozenHashTable: no perfect hash found");
+                }
+            }
+            pilots_[bucket] = pilot;
+            first = last;
+        }
+        for (size_type id = 0; id < count; ++id) {
+            slots_[id] = std::move(values[placed[id]]);
+            if constexpr (cached_hash_) {
+                hashes_[id] = hashes[placed[id]];
+            }
+        }
+    }
+
+    [[no_unique_address]] hasher hash_;
+    [[no_unique_address]] key_equal equal_;
+    array_type<pilot_type, fixed_ ? bucket_count_for(N) : 0> pilots_{};
+    array_type<value_type, fixed_ ? N : 0> slots_{};
+    // slots_[i]'s hash, if cached_hash_
+    array_type<size_type, fixed_ && cached_hash_ ? N : 0> hashes_{};
+};
+
+// keys are not const: the table moves elements into place while it is
+// built, and only hands out const references afterwards
+template<
+        class Key,
+        class T,
+        std::size_t N = std::dynamic_extent,
+        class Hash = FrozenHash,
+        class Equal = std::equal_to<>
+>
+using FrozenMap = FrozenHashTable<Key, std::pair<Key, T>, SelectFirst, N, Hash, Equal>;
+
+template<
+        class Key,
+        std::size_t N = std::dynamic_extent,
+        class Hash = FrozenHash,
+        class Equal = std::equal_to<>
+>
+using FrozenSet = FrozenHashTable<Key, Key, Identity, N, Hash, Equal>;
+
+// a FrozenMap sized by its initializer, usable in constant expressions:
+// constexpr auto venues = make_frozen_map<std::string_view, int>({{"XNAS", 1}, {"XLON", 2}});
+template<class Key, class T, std::size_t N>
+constexpr FrozenMap<Key, T, N> make_frozen_map(const std::pair<Key, T> (&init)[N]) {
+    return FrozenMap<Key, T, N>(std::begin(init), std::end(init));
+}
+
+template<class Key, std::size_t N>
+constexpr FrozenSet<Key, N> make_frozen_set(const Key (&init)[N]) {
+    return FrozenSet<Key, N>(std::begin(init), std::end(init));
+}
+
+// runtime snapshot of a map that won't change any more, looked up with
+// the map's own hasher and key_equal unless others are given
+template<class Key, class T, class CollisionPolicy, class Hash, class Equal, class... Rest>
+FrozenMap<Key, T, std::dynamic_extent, Hash, Equal>
+freeze(const HashMap<Key, T, CollisionPolicy, Hash, Equal, Rest...> &map, const Hash &hash, const Equal &equal) {
+    return FrozenMap<Key, T, std::dynamic_extent, Hash, Equal>(map.begin(), map.end(), hash, equal);
+}
+
+template<class Key, class T, class CollisionPolicy, class Hash, class Equal, class... Rest>
+FrozenMap<Key, T, std::dynamic_extent, Hash, Equal>
+freeze(const HashMap<Key, T, CollisionPolicy, Hash, Equal, Rest...> &map) {
+    return freeze(map, map.hash_function(), map.key_eq());
+}
+
+template<class Key, class CollisionPolicy, class Hash, class Equal, class... Rest>
+FrozenSet<Key, std::dynamic_extent, Hash, Equal>
+freeze(const HashSet<Key, CollisionPolicy, Hash, Equal, Rest...> &set, const Hash &hash, const Equal &equal) {
+    return FrozenSet<Key, std::dynamic_extent, Hash, Equal>(set.begin(), set.end(), hash, equal);
+}
+
+template<class Key, class CollisionPolicy, class Hash, class Equal, class... Rest>
+FrozenSet<Key, std::dynamic_extent, Hash, Equal>
+freeze(const HashSet<Key, CollisionPolicy, Hash, Equal, Rest...> &set) {
+    return freeze(set, set.hash_function(), set.key_eq());
+}
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <bit>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GROUP_USE_SSE2
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define GROUP_USE_NEON
+#endif
+
+// control byte of a slot, kept in an array separate from the slots themselves:
+// FREE or DELETED for unused slots, 7 bits of the element's hash (0..127) otherwise
+using ctrl_t = signed char;
+
+enum CtrlByte : ctrl_t {
+    CTRL_FREE = -128,
+    CTRL_DELETED = -2,
+    CTRL_SENTINEL = -1
+};
+
+inline bool is_full(ctrl_t ctrl) {
+    return ctrl >= 0;
+}
+
+// asks the cpu to start loading the cache line of `ptr` without waiting for
+// it; a no-op on compilers without a prefetch builtin
+inline void prefetch(const void *ptr) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(ptr);
+#elif defined(GROUP_USE_SSE2) || defined(__AVX2__)
+    _mm_prefetch(static_cast<const char *>(ptr), _MM_HINT_T0);
+#else
+    (void) ptr;
+#endif
+}
+
+// set of matching positions inside a group; every position takes `1 << Shift` bits
+template<class T, int Shift>
+class BitMask {
+private:
+    T mask_;
+public:
+    class Iterator {
+    private:
+        T mask_;
+    public:
+        explicit Iterator(T mask) : mask_(mask) {}
+
+        std::size_t operator*() const {
+            return static_cast<std::size_t>(std::countr_zero(mask_)) >> Shift;
+        }
+
+        Iterator &operator++() {
+            mask_ &= mask_ - 1;
+            return *this;
+        }
+
+        bool operator!=(const Iterator &other) const {
+            return mask_ != other.mask_;
+        }
+    };
+
+    explicit BitMask(T mask) : mask_(mask) {}
+
+    explicit operator bool() const {
+        return mask_ != 0;
+    }
+
+    // first matching position, mask must not be empty
+    std::size_t lowest() const {
+        return static_cast<std::size_t>(std::countr_zero(mask_)) >> Shift;
+    }
+
+    Iterator begin() const {
+        return Iterator(mask_);
+    }
+
+    Iterator end() const {
+        return Iterator(0);
+    }
+};
+
+// `width` consecutive control bytes compared in one go
+#if defined(__AVX2__)
+
+struct Group {
+    static constexpr std::size_t width = 32;
+    using Mask = BitMask<std::uint32_t, 0>;
+
+    __m256i ctrl;
+
+    explicit Group(const ctrl_t *pos) : ctrl(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(pos))) {}
+
+    Mask match(ctrl_t h2) const {
+        return Mask(to_mask(_mm256_cmpeq_epi8(_mm256_set1_epi8(h2), ctrl)));
+    }
+
+    Mask match_free() const {
+        return match(CTRL_FREE);
+    }
+
+    Mask match_free_or_deleted() const {
+        return Mask(to_mask(_mm256_cmpgt_epi8(_mm256_set1_epi8(CTRL_SENTINEL), ctrl)));
+    }
+
+    Mask match_full() const {
+        return Mask(~to_mask(ctrl));
+    }
+
+private:
+    static std::uint32_t to_mask(__m256i v) {
+        return static_cast<std::uint32_t>(_mm256_movemask_epi8(v));
+    }
+};
+
+#elif defined(GROUP_USE_SSE2)
+
+struct Group {
+    static constexpr std::size_t width = 16;
+    using Mask = BitMask<std::uint32_t, 0>;
+
+    __m128i ctrl;
+
+    explicit Group(const ctrl_t *pos) : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pos))) {}
+
+    Mask match(ctrl_t h2) const {
+        return Mask(to_mask(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl)));
+    }
+
+    Mask match_free() const {
+        return match(CTRL_FREE);
+    }
+
+    Mask match_free_or_deleted() const {
+        return Mask(to_mask(_mm_cmpgt_epi8(_mm_set1_epi8(CTRL_SENTINEL), ctrl)));
+    }
+
+    Mask match_full() const {
+        return Mask(to_mask(ctrl) ^ 0xffffu);
+    }
+
+private:
+    static std::uint32_t to_mask(__m128i v) {
+        return static_cast<std::uint32_t>(_mm_movemask_epi8(v));
+    }
+};
+
+#elif defined(GROUP_USE_NEON)
+
+struct Group {
+    static constexpr std::size_t width = 8;
+    using Mask = BitMask<std::uint64_t, 3>;
+
+    int8x8_t ctrl;
+
+    explicit Group(const ctrl_t *pos) : ctrl(vld1_s8(reinterpret_cast<const int8_t *>(pos))) {}
+
+    Mask match(ctrl_t h2) const {
+        return Mask(to_mask(vceq_s8(vdup_n_s8(h2), ctrl)));
+    }
+
+    Mask match_free() const {
+        return match(CTRL_FREE);
+    }
+
+    Mask match_free_or_deleted() const {
+        return Mask(to_mask(vcgt_s8(vdup_n_s8(CTRL_SENTINEL), ctrl)));
+    }
+
+    Mask match_full() const {
+        return Mask(to_mask(vcge_s8(ctrl, vdup_n_s8(0))));
+    }
+
+private:
+    static std::uint64_t to_mask(uint8x8_t v) {
+        return vget_lane_u64(vreinterpret_u64_u8(v), 0) & 0x8080808080808080ull;
+    }
+};
+
+#else
+
+// portable fallback: eight control bytes packed into one 64-bit word
+struct Group {
+    static constexpr std::size_t width = 8;
+    using Mask = BitMask<std::uint64_t, 3>;
+
+    std::uint64_t ctrl;
+
+    explicit Group(const ctrl_t *pos) : ctrl(0) {
+        for (std::size_t i = 0; i < width; ++i) {
+            ctrl |= std::uint64_t(static_cast<unsigned char>(pos[i])) << (8 * i);
+        }
+    }
+
+    Mask match(ctrl_t h2) const {
+        std::uint64_t x = ctrl ^ (lsbs * static_cast<unsigned char>(h2));
+        // may report false positives next to a real match, keys are compared anyway
+        return Mask((x - lsbs) & ~x & msbs);
+    }
+
+    Mask match_free() const {
+        return Mask(ctrl & ~(ctrl << 6) & msbs);
+    }
+
+    Mask match_free_or_deleted() const {
+        return Mask(ctrl & ~(ctrl << 7) & msbs);
+    }
+
+    Mask match_full() const {
+        return Mask((ctrl ^ msbs) & msbs);
+    }
+
+private:
+    static constexpr std::uint64_t lsbs = 0x0101010101010101ull;
+    static constexpr std::uint64_t msbs = 0x8080808080808080ull;
+};
+
+#endif
+
+// first full control byte in [pos, end), or end; empty runs are skipped a
+// whole group at a time, only the last partial group goes byte by byte
+inline const ctrl_t *next_full_ctrl(const ctrl_t *pos, const ctrl_t *end) {
+    for (; end - pos >= static_cast<std::ptrdiff_t>(Group::width); pos += Group::width) {
+        auto full = Group(pos).match_full();
+        if (full) {
+            return pos + full.lowest();
+        }
+    }
+    while (pos != end && !is_full(*pos)) {
+        ++pos;
+    }
+    return pos;
+}
+
+#undef GROUP_USE_SSE2
+#undef GROUP_USE_NEON
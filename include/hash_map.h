@@ -2,14 +2,24 @@
 
 #include "policy.h"
 #include "hash_table.h"
+#include "incremental_hash_table.h"
 #include <functional>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <ostream>
 
 template<
         class Key,
         class T,
         class CollisionPolicy = LinearProbing,
         class Hash = std::hash<Key>,
-        class Equal = std::equal_to<Key>
+        class Equal = std::equal_to<Key>,
+        class Storage = default_storage_t<Key, Hash>,
+        class IndexPolicy = PowerOfTwoMasking,
+        class StatsPolicy = NoStats,
+        class ResizePolicy = FullRehash,
+        class Allocator = std::allocator<std::pair<const Key, T>>
 >
 class HashMap {
 
@@ -22,7 +32,9 @@ public:
     using hasher = Hash;
     using key_equal = Equal;
     using size_type = std::size_t;
-    using Table = HashTable<Key, value_type, CollisionPolicy, Hash, Equal>;
+    using allocator_type = Allocator;
+    using Table = select_table_t<Key, value_type, SelectFirst, CollisionPolicy, Hash, Equal, Storage, IndexPolicy, StatsPolicy,
+            ResizePolicy, Allocator>;
     using key_type = Key;
     using mapped_type = T;
     using difference_type = std::ptrdiff_t;
@@ -33,38 +45,53 @@ public:
 
     using iterator = HashMapIterator<typename Table::iterator, value_type>;
     using const_iterator = HashMapIterator<typename Table::const_iterator, const value_type>;
+    using node_type = typename Table::node_type;
+
+    struct insert_return_type {
+        iterator position;
+        bool inserted;
+        node_type node;
+    };
 
     explicit HashMap(size_type expected_max_size = 4,
                      const hasher &hash = hasher(),
-                     const key_equal &equal = key_equal()) : table(
-            [](const value_type &val) -> const Key & { return val.first; }, expected_max_size, hash, equal) {}
+                     const key_equal &equal = key_equal(),
+                     const allocator_type &alloc = allocator_type()) : table(expected_max_size, hash, equal,
+                                                                             SelectFirst(), alloc) {}
+
+    explicit HashMap(const allocator_type &alloc) : HashMap(4, hasher(), key_equal(), alloc) {}
 
     template<class InputIt>
     HashMap(InputIt first, InputIt last,
             size_type expected_max_size = 4,
             const hasher &hash = hasher(),
-            const key_equal &equal = key_equal()) : table(first, last,
-                                                          [](const value_type &val) -> const Key & { return val.first; },
-                                                          expected_max_size, hash, equal) {}
+            const key_equal &equal = key_equal(),
+            const allocator_type &alloc = allocator_type()) : table(first, last, expected_max_size,
+                                                                    hash, equal, SelectFirst(), alloc) {}
 
     HashMap(const HashMap &) = default;
 
-    HashMap(HashMap &&) noexcept = default;
+    HashMap(HashMap &&) noexcept(std::is_nothrow_move_constructible_v<Table>) = default;
 
     HashMap(std::initializer_list<value_type> init,
             size_type expected_max_size = 4,
             const hasher &hash = hasher(),
-            const key_equal &equal = key_equal()) : table(init,
-                                                          [](const value_type &val) -> const Key & { return val.first; },
-                                                          expected_max_size, hash, equal) {}
+            const key_equal &equal = key_equal(),
+            const allocator_type &alloc = allocator_type()) : table(init, expected_max_size, hash, equal,
+                                                                    SelectFirst(), alloc) {}
+
+    HashMap(const HashMap &o, const allocator_type &alloc) : table(o.table, alloc) {}
 
+    HashMap(HashMap &&o, const allocator_type &alloc) : table(std::move(o.table), alloc) {}
+
+    // the allocator follows the std containers' propagation rules
     HashMap &operator=(const HashMap &other) {
-        swap(HashMap(other));
+        table = other.table;
         return *this;
     };
 
-    HashMap &operator=(HashMap &&other) noexcept {
-        swap(std::move(other));
+    HashMap &operator=(HashMap &&other) noexcept(std::is_nothrow_move_assignable_v<Table>) {
+        table = std::move(other.table);
         return *this;
     };
 
@@ -109,6 +136,18 @@ public:
         return table.max_size();
     }
 
+    allocator_type get_allocator() const {
+        return table.get_allocator();
+    }
+
+    hasher hash_function() const {
+        return table.hash_function();
+    }
+
+    key_equal key_eq() const {
+        return table.key_eq();
+    }
+
     void clear() {
         return table.clear();
     }
@@ -124,16 +163,22 @@ public:
     }
 
     iterator insert(const_iterator hint, const value_type &key) {
-        return iterator(table.emplace_hint(hint, key));
+        return iterator(table.emplace_hint(hint.source(), key));
     }
 
     iterator insert(const_iterator hint, value_type &&key) {
-        return iterator(table.emplace_hint(hint, std::move(key)));
+        return iterator(table.emplace_hint(hint.source(), std::move(key)));
     }
 
     template<class P>
     std::pair<iterator, bool> insert(P &&value) {
-        return emplace(std::forward<P>(value));
+        if constexpr (requires { value.first; } &&
+                      std::is_same_v<std::remove_cvref_t<decltype(value.first)>, key_type>) {
+            auto tmp = table.emplace_key(value.first, std::forward<P>(value));
+            return {iterator(tmp.first), tmp.second};
+        } else {
+            return emplace(std::forward<P>(value));
+        }
     }
 
     template<class P>
@@ -150,6 +195,38 @@ public:
         table.insert(init);
     }
 
+    // insert(first, last), with the home slots of each batch of elements
+    // prefetched before any of them is probed
+    template<std::forward_iterator It>
+    void insert_batch(It first, It last) {
+        table.insert_batch(first, last);
+    }
+
+    // writes the slot array for MappedHashMap to open without loading it,
+    // see HashTable::save; incrementally resized maps can't be saved
+    void save(std::ostream &out) const requires requires(const Table &t) { t.save(out); } {
+        table.save(out);
+    }
+
+    // insert(first, last) split across `threads` threads (hardware_concurrency()
+    // when 0), each filling its own region of the slot array
+    template<std::random_access_iterator It>
+    void parallel_insert(It first, It last, size_type threads = 0) {
+        table.parallel_insert(first, last, threads);
+    }
+
+    // calls `f(value_type &)` on every element, from `threads` threads at once;
+    // `f` must be safe to run concurrently and must not insert or erase
+    template<class F>
+    void parallel_for_each(F &&f, size_type threads = 0) {
+        table.parallel_for_each(f, threads);
+    }
+
+    template<class F>
+    void parallel_for_each(F &&f, size_type threads = 0) const {
+        table.parallel_for_each(f, threads);
+    }
+
     template<class M>
     std::pair<iterator, bool> insert_or_assign(const key_type &key, M &&value) {
         std::pair<iterator, bool> res = try_emplace(key, std::forward<M>(value));
@@ -187,31 +264,35 @@ public:
         return {iterator(tmp.first), tmp.second};
     }
 
+    // key given directly: probe with it before constructing anything
+    template<class K, class M>
+    requires std::is_same_v<std::remove_cvref_t<K>, key_type>
+    std::pair<iterator, bool> emplace(K &&key, M &&value) {
+        auto tmp = table.emplace_key(key, std::forward<K>(key), std::forward<M>(value));
+        return {iterator(tmp.first), tmp.second};
+    }
+
     template<class... Args>
     iterator emplace_hint(const_iterator hint, Args &&... args) {
         return iterator(table.emplace_hint(hint.source(), std::forward<Args>(args)...));
     }
 
+    // one probe finds the key or the slot for it; the value is only
+    // constructed (and `key` only moved from) when it is actually inserted
     template<class... Args>
     std::pair<iterator, bool> try_emplace(const key_type &key, Args &&... args) {
-        auto it = find(key);
-        if (it != end()) {
-            return {it, false};
-        }
-        return emplace(std::piecewise_construct,
-                       std::forward_as_tuple(key),
-                       std::forward_as_tuple(std::forward<Args>(args)...));
+        auto tmp = table.emplace_key(key, std::piecewise_construct,
+                                     std::forward_as_tuple(key),
+                                     std::forward_as_tuple(std::forward<Args>(args)...));
+        return {iterator(tmp.first), tmp.second};
     }
 
     template<class... Args>
     std::pair<iterator, bool> try_emplace(key_type &&key, Args &&... args) {
-        auto it = find(key);
-        if (it != end()) {
-            return {it, false};
-        }
-        return emplace(std::piecewise_construct,
-                       std::forward_as_tuple(std::move(key)),
-                       std::forward_as_tuple(std::forward<Args>(args)...));
+        auto tmp = table.emplace_key(key, std::piecewise_construct,
+                                     std::forward_as_tuple(std::move(key)),
+                                     std::forward_as_tuple(std::forward<Args>(args)...));
+        return {iterator(tmp.first), tmp.second};
     }
 
     template<class... Args>
@@ -236,16 +317,63 @@ public:
         return table.erase(key);
     }
 
+    template<class K>
+    requires (Table::transparent_lookup && !std::is_convertible_v<K, iterator> &&
+              !std::is_convertible_v<K, const_iterator>)
+    size_type erase(K &&key) {
+        return table.erase(std::forward<K>(key));
+    }
+
+    // unlinks an element without destroying it, to be inserted into another
+    // HashMap of this type; empty if there was no such key
+    node_type extract(const_iterator pos) {
+        return table.extract(pos.source());
+    }
+
+    node_type extract(const key_type &key) {
+        return table.extract(key);
+    }
+
+    template<class K>
+    requires (Table::transparent_lookup && !std::is_convertible_v<K, iterator> &&
+              !std::is_convertible_v<K, const_iterator>)
+    node_type extract(K &&key) {
+        return table.extract(std::forward<K>(key));
+    }
+
+    // hands `node` back unless its key was absent
+    insert_return_type insert(node_type &&node) {
+        auto tmp = table.insert(std::move(node));
+        return {iterator(tmp.position), tmp.inserted, std::move(tmp.node)};
+    }
+
+    // moves the elements of `source` whose keys are absent here over,
+    // slot to slot; the others stay in `source`
+    void merge(HashMap &source) {
+        table.merge(source.table);
+    }
+
+    void merge(HashMap &&source) {
+        table.merge(source.table);
+    }
+
     // exchanges the contents of the container with those of other;
-    // does not invoke any move, copy, or swap operations on individual elements
-    void swap(HashMap &&other) noexcept {
-        std::swap(other.table, table);
+    // does not invoke any move, copy, or swap operations on individual
+    // elements, but for those kept inline (see InlineBuffer)
+    void swap(HashMap &&other) noexcept(std::is_nothrow_move_constructible_v<Table>) {
+        table.swap(std::move(other.table));
     }
 
     size_type count(const key_type &key) const {
         return table.count(key);
     }
 
+    template<class K>
+    requires Table::transparent_lookup
+    size_type count(const K &key) const {
+        return table.count(key);
+    }
+
     iterator find(const key_type &key) {
         return iterator(table.find(key));
     }
@@ -254,8 +382,58 @@ public:
         return const_iterator(table.find(key));
     }
 
+    template<class K>
+    requires Table::transparent_lookup
+    iterator find(const K &key) {
+        return iterator(table.find(key));
+    }
+
+    template<class K>
+    requires Table::transparent_lookup
+    const_iterator find(const K &key) const {
+        return const_iterator(table.find(key));
+    }
+
     bool contains(const key_type &key) const {
-        return find(key) != end();
+        return table.contains(key);
+    }
+
+    template<class K>
+    requires Table::transparent_lookup
+    bool contains(const K &key) const {
+        return table.contains(key);
+    }
+
+    // writes find(key) for every key of [first, last) to `out`; the keys are
+    // hashed and their home slots prefetched a batch at a time, so lookups
+    // of a batch wait for memory together rather than one after another
+    template<std::forward_iterator It, class OutputIt>
+    requires (Table::transparent_lookup || std::is_same_v<std::iter_value_t<It>, key_type>)
+    OutputIt find_batch(It first, It last, OutputIt out) {
+        table.find_batch(first, last, [&](typename Table::iterator it) {
+            *out++ = iterator(it);
+        });
+        return out;
+    }
+
+    template<std::forward_iterator It, class OutputIt>
+    requires (Table::transparent_lookup || std::is_same_v<std::iter_value_t<It>, key_type>)
+    OutputIt find_batch(It first, It last, OutputIt out) const {
+        table.find_batch(first, last, [&](typename Table::const_iterator it) {
+            *out++ = const_iterator(it);
+        });
+        return out;
+    }
+
+    // writes contains(key) for every key of [first, last) to `out`, batched like find_batch
+    template<std::forward_iterator It, class OutputIt>
+    requires (Table::transparent_lookup || std::is_same_v<std::iter_value_t<It>, key_type>)
+    OutputIt contains_batch(It first, It last, OutputIt out) const {
+        auto end = table.end();
+        table.find_batch(first, last, [&](typename Table::const_iterator it) {
+            *out++ = it != end;
+        });
+        return out;
     }
 
     std::pair<iterator, iterator> equal_range(const key_type &key) {
@@ -268,6 +446,20 @@ public:
         return {const_iterator(tmp.first), const_iterator(tmp.second)};
     }
 
+    template<class K>
+    requires Table::transparent_lookup
+    std::pair<iterator, iterator> equal_range(const K &key) {
+        auto tmp = table.equal_range(key);
+        return {iterator(tmp.first), iterator(tmp.second)};
+    }
+
+    template<class K>
+    requires Table::transparent_lookup
+    std::pair<const_iterator, const_iterator> equal_range(const K &key) const {
+        auto tmp = table.equal_range(key);
+        return {const_iterator(tmp.first), const_iterator(tmp.second)};
+    }
+
     mapped_type &at(const key_type &key) {
         iterator it = find(key);
         if (it == end()) {
@@ -284,6 +476,26 @@ public:
         return it->second;
     }
 
+    template<class K>
+    requires Table::transparent_lookup
+    mapped_type &at(const K &key) {
+        iterator it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("No such key");
+        }
+        return it->second;
+    }
+
+    template<class K>
+    requires Table::transparent_lookup
+    const mapped_type &at(const K &key) const {
+        const_iterator it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("No such key");
+        }
+        return it->second;
+    }
+
     mapped_type &operator[](const key_type &key) {
         return try_emplace(key).first->second;
     }
@@ -316,6 +528,10 @@ public:
         return table.max_load_factor();
     }
 
+    void max_load_factor(float ml) {
+        table.max_load_factor(ml);
+    }
+
     void rehash(const size_type count) {
         table.rehash(count);
     }
@@ -324,7 +540,52 @@ public:
         table.reserve(count);
     }
 
-    // compare two containers contents
+    // probe lengths, tombstones and rehash history, available with CollectStats
+    HashTableStats stats() const requires StatsPolicy::enabled {
+        return table.stats();
+    }
+
+    // intersect, unite and difference by key, found by ADL, see SetAlgebra;
+    // where both maps hold a key, the result keeps the value from `a`
+    friend HashMap intersect(const HashMap &a, const HashMap &b) {
+        return HashMap(SetAlgebra<Table>::intersect(a.table, b.table));
+    }
+
+    friend HashMap intersect(HashMap &&a, const HashMap &b) {
+        return HashMap(SetAlgebra<Table>::intersect(std::move(a.table), b.table));
+    }
+
+    friend HashMap unite(const HashMap &a, const HashMap &b) {
+        return HashMap(SetAlgebra<Table>::unite(a.table, b.table));
+    }
+
+    friend HashMap unite(HashMap &&a, HashMap &&b) {
+        return HashMap(SetAlgebra<Table>::unite(std::move(a.table), std::move(b.table)));
+    }
+
+    // elements of `a` whose keys `b` lacks
+    friend HashMap difference(const HashMap &a, const HashMap &b) {
+        return HashMap(SetAlgebra<Table>::difference(a.table, b.table));
+    }
+
+    friend HashMap difference(HashMap &&a, const HashMap &b) {
+        return HashMap(SetAlgebra<Table>::difference(std::move(a.table), b.table));
+    }
+
+    // std::erase_if for HashMap, found by ADL: one sweep over the slot array
+    // calling `pred(value_type &)`, see HashTable::erase_if
+    template<class Pred>
+    friend size_type erase_if(HashMap &map, Pred pred) {
+        return map.table.erase_if(pred);
+    }
+
+    // order-independent hash of the keys, see HashTable::fingerprint;
+    // mapped values are left out, assigning to them doesn't change it
+    size_type fingerprint() const {
+        return table.fingerprint();
+    }
+
+    // same keys mapped to equal values
     friend bool operator==(const HashMap &lhs, const HashMap &rhs) {
         return lhs.table == rhs.table;
     }
@@ -354,11 +615,11 @@ private:
         }
 
         reference operator*() const {
-            return it->data();
+            return *it;
         }
 
         pointer operator->() const {
-            return &it->data();
+            return &*it;
         }
 
         HashMapIterator &operator++() {
@@ -389,5 +650,29 @@ private:
         }
     };
 
+    explicit HashMap(Table &&t) : table(std::move(t)) {}
+
     Table table;
 };
+
+// hashes a HashMap by its keys in O(1): maps differing only in values
+// collide, but equal maps never hash apart (hashers are stateless)
+template<class Key, class T, class CollisionPolicy, class Hash, class Equal, class Storage, class IndexPolicy,
+        class StatsPolicy, class ResizePolicy, class Allocator>
+requires std::is_empty_v<Hash>
+struct std::hash<HashMap<Key, T, CollisionPolicy, Hash, Equal, Storage, IndexPolicy, StatsPolicy, ResizePolicy,
+        Allocator>> {
+    std::size_t operator()(const HashMap<Key, T, CollisionPolicy, Hash, Equal, Storage, IndexPolicy, StatsPolicy,
+            ResizePolicy, Allocator> &map) const noexcept {
+        return map.fingerprint();
+    }
+};
+
+namespace pmr {
+// HashMap allocating from a std::pmr::memory_resource, e.g. an arena
+template<class Key, class T, class CollisionPolicy = LinearProbing, class Hash = std::hash<Key>,
+        class Equal = std::equal_to<Key>, class Storage = default_storage_t<Key, Hash>,
+        class IndexPolicy = PowerOfTwoMasking, class StatsPolicy = NoStats, class ResizePolicy = FullRehash>
+using HashMap = ::HashMap<Key, T, CollisionPolicy, Hash, Equal, Storage, IndexPolicy, StatsPolicy, ResizePolicy,
+        std::pmr::polymorphic_allocator<std::pair<const Key, T>>>;
+}
@@ -1,19 +1,29 @@
 #pragma once
 
 #include <functional>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
 #include <iostream>
 #include "policy.h"
 #include "hash_table.h"
+#include "incremental_hash_table.h"
 
 template<
         class Key,
         class CollisionPolicy = LinearProbing,
         class Hash = std::hash<Key>,
-        class Equal = std::equal_to<Key>
+        class Equal = std::equal_to<Key>,
+        class Storage = default_storage_t<Key, Hash>,
+        class IndexPolicy = PowerOfTwoMasking,
+        class StatsPolicy = NoStats,
+        class ResizePolicy = FullRehash,
+        class Allocator = std::allocator<Key>
 >
 class HashSet {
 private:
-    using Table = HashTable<Key, Key, CollisionPolicy, Hash, Equal>;
+    using Table = select_table_t<Key, Key, Identity, CollisionPolicy, Hash, Equal, Storage, IndexPolicy, StatsPolicy,
+            ResizePolicy, Allocator>;
 
     template<class It>
     class HashSetIterator {
@@ -21,7 +31,7 @@ private:
         It it;
     public:
         using iterator_category = std::forward_iterator_tag;
-        using value_type = const typename It::value_type::Type;
+        using value_type = const typename It::value_type;
         using difference_type = std::ptrdiff_t;
         using pointer = value_type *;
         using reference = value_type &;
@@ -35,11 +45,11 @@ private:
         }
 
         reference operator*() const {
-            return it->data();
+            return *it;
         }
 
         pointer operator->() const {
-            return it->data_;
+            return &*it;
         }
 
         HashSetIterator &operator++() {
@@ -71,6 +81,8 @@ private:
     };
 
     Table table;
+
+    explicit HashSet(Table &&t) : table(std::move(t)) {}
 public:
     // types
     using key_type = Key;
@@ -79,6 +91,7 @@ public:
     using difference_type = std::ptrdiff_t;
     using hasher = Hash;
     using key_equal = Equal;
+    using allocator_type = Allocator;
     using reference = value_type &;
     using const_reference = const value_type &;
     using pointer = value_type *;
@@ -86,38 +99,53 @@ public:
 
     using iterator = HashSetIterator<typename Table::const_iterator>;
     using const_iterator =  HashSetIterator<typename Table::const_iterator>;
+    using node_type = typename Table::node_type;
+
+    struct insert_return_type {
+        iterator position;
+        bool inserted;
+        node_type node;
+    };
 
     explicit HashSet(size_type expected_max_size = 1,
                      const hasher &hash = hasher(),
-                     const key_equal &equal = key_equal()) : table(
-            [](const_reference val) -> const_reference { return val; }, expected_max_size, hash, equal) {}
+                     const key_equal &equal = key_equal(),
+                     const allocator_type &alloc = allocator_type()) : table(expected_max_size, hash, equal,
+                                                                             Identity(), alloc) {}
+
+    explicit HashSet(const allocator_type &alloc) : HashSet(1, hasher(), key_equal(), alloc) {}
 
     template<class InputIt>
     HashSet(InputIt first, InputIt last,
             size_type expected_max_size = 1,
             const hasher &hash = hasher(),
-            const key_equal &equal = key_equal()) : table(first, last,
-                                                          [](const_reference val) -> const_reference { return val; },
-                                                          expected_max_size, hash, equal) {}
+            const key_equal &equal = key_equal(),
+            const allocator_type &alloc = allocator_type()) : table(first, last, expected_max_size,
+                                                                    hash, equal, Identity(), alloc) {}
 
     HashSet(const HashSet &o) : table(o.table) {}
 
-    HashSet(HashSet &&o) noexcept : table(std::move(o.table)) {}
+    HashSet(HashSet &&o) noexcept(std::is_nothrow_move_constructible_v<Table>) : table(std::move(o.table)) {}
 
     HashSet(std::initializer_list<value_type> init,
             size_type expected_max_size = 1,
             const hasher &hash = hasher(),
-            const key_equal &equal = key_equal()) : table(init,
-                                                          [](const_reference val) -> const_reference { return val; },
-                                                          expected_max_size, hash, equal) {}
+            const key_equal &equal = key_equal(),
+            const allocator_type &alloc = allocator_type()) : table(init, expected_max_size, hash, equal,
+                                                                    Identity(), alloc) {}
+
+    HashSet(const HashSet &o, const allocator_type &alloc) : table(o.table, alloc) {}
+
+    HashSet(HashSet &&o, const allocator_type &alloc) : table(std::move(o.table), alloc) {}
 
+    // the allocator follows the std containers' propagation rules
     HashSet &operator=(const HashSet &other) {
-        swap(HashSet(other));
+        table = other.table;
         return *this;
     };
 
-    HashSet &operator=(HashSet &&other) noexcept {
-        swap(std::move(other));
+    HashSet &operator=(HashSet &&other) noexcept(std::is_nothrow_move_assignable_v<Table>) {
+        table = std::move(other.table);
         return *this;
     };
 
@@ -162,6 +190,18 @@ public:
         return table.max_size();
     }
 
+    allocator_type get_allocator() const {
+        return table.get_allocator();
+    }
+
+    hasher hash_function() const {
+        return table.hash_function();
+    }
+
+    key_equal key_eq() const {
+        return table.key_eq();
+    }
+
     void clear() {
         return table.clear();
     }
@@ -177,11 +217,11 @@ public:
     }
 
     iterator insert(const_iterator hint, const value_type &key) {
-        return iterator(table.insert(hint, key));
+        return iterator(table.insert(hint.source(), key));
     }
 
     iterator insert(const_iterator hint, value_type &&key) {
-        return iterator(table.insert(hint, std::move(key)));
+        return iterator(table.insert(hint.source(), std::move(key)));
     }
 
     template<class InputIt>
@@ -193,6 +233,33 @@ public:
         table.insert(init);
     }
 
+    // insert(first, last), with the home slots of each batch of elements
+    // prefetched before any of them is probed
+    template<std::forward_iterator It>
+    void insert_batch(It first, It last) {
+        table.insert_batch(first, last);
+    }
+
+    // writes the slot array for MappedHashSet to open without loading it,
+    // see HashTable::save; incrementally resized maps can't be saved
+    void save(std::ostream &out) const requires requires(const Table &t) { t.save(out); } {
+        table.save(out);
+    }
+
+    // insert(first, last) split across `threads` threads (hardware_concurrency()
+    // when 0), each filling its own region of the slot array
+    template<std::random_access_iterator It>
+    void parallel_insert(It first, It last, size_type threads = 0) {
+        table.parallel_insert(first, last, threads);
+    }
+
+    // calls `f(const value_type &)` on every element, from `threads` threads
+    // at once; `f` must be safe to run concurrently
+    template<class F>
+    void parallel_for_each(F &&f, size_type threads = 0) const {
+        table.parallel_for_each(f, threads);
+    }
+
     // construct element in-place, no copy or move operations are performed;
     // element's constructor is called with exact same arguments as `emplace` method
     // (using `std::forward<Args>(args)...`)
@@ -219,16 +286,63 @@ public:
         return table.erase(key);
     }
 
+    template<class K>
+    requires (Table::transparent_lookup && !std::is_convertible_v<K, iterator> &&
+              !std::is_convertible_v<K, const_iterator>)
+    size_type erase(K &&key) {
+        return table.erase(std::forward<K>(key));
+    }
+
+    // unlinks an element without destroying it, to be inserted into another
+    // HashSet of this type; empty if there was no such key
+    node_type extract(const_iterator pos) {
+        return table.extract(pos.source());
+    }
+
+    node_type extract(const key_type &key) {
+        return table.extract(key);
+    }
+
+    template<class K>
+    requires (Table::transparent_lookup && !std::is_convertible_v<K, iterator> &&
+              !std::is_convertible_v<K, const_iterator>)
+    node_type extract(K &&key) {
+        return table.extract(std::forward<K>(key));
+    }
+
+    // hands `node` back unless its key was absent
+    insert_return_type insert(node_type &&node) {
+        auto tmp = table.insert(std::move(node));
+        return {iterator(tmp.position), tmp.inserted, std::move(tmp.node)};
+    }
+
+    // moves the elements of `source` whose keys are absent here over,
+    // slot to slot; the others stay in `source`
+    void merge(HashSet &source) {
+        table.merge(source.table);
+    }
+
+    void merge(HashSet &&source) {
+        table.merge(source.table);
+    }
+
     // exchanges the contents of the container with those of other;
-    // does not invoke any move, copy, or swap operations on individual elements
-    void swap(HashSet &&other) noexcept {
-        std::swap(other.table, table);
+    // does not invoke any move, copy, or swap operations on individual
+    // elements, but for those kept inline (see InlineBuffer)
+    void swap(HashSet &&other) noexcept(std::is_nothrow_move_constructible_v<Table>) {
+        table.swap(std::move(other.table));
     }
 
     size_type count(const key_type &key) const {
         return table.count(key);
     }
 
+    template<class K>
+    requires Table::transparent_lookup
+    size_type count(const K &key) const {
+        return table.count(key);
+    }
+
     iterator find(const key_type &key) {
         return iterator(table.find(key));
     }
@@ -237,10 +351,51 @@ public:
         return const_iterator(table.find(key));
     }
 
+    template<class K>
+    requires Table::transparent_lookup
+    iterator find(const K &key) {
+        return iterator(table.find(key));
+    }
+
+    template<class K>
+    requires Table::transparent_lookup
+    const_iterator find(const K &key) const {
+        return const_iterator(table.find(key));
+    }
+
     bool contains(const key_type &key) const {
         return table.contains(key);
     }
 
+    template<class K>
+    requires Table::transparent_lookup
+    bool contains(const K &key) const {
+        return table.contains(key);
+    }
+
+    // writes find(key) for every key of [first, last) to `out`; the keys are
+    // hashed and their home slots prefetched a batch at a time, so lookups
+    // of a batch wait for memory together rather than one after another
+    template<std::forward_iterator It, class OutputIt>
+    requires (Table::transparent_lookup || std::is_same_v<std::iter_value_t<It>, key_type>)
+    OutputIt find_batch(It first, It last, OutputIt out) const {
+        table.find_batch(first, last, [&](typename Table::const_iterator it) {
+            *out++ = const_iterator(it);
+        });
+        return out;
+    }
+
+    // writes contains(key) for every key of [first, last) to `out`, batched like find_batch
+    template<std::forward_iterator It, class OutputIt>
+    requires (Table::transparent_lookup || std::is_same_v<std::iter_value_t<It>, key_type>)
+    OutputIt contains_batch(It first, It last, OutputIt out) const {
+        auto end = table.end();
+        table.find_batch(first, last, [&](typename Table::const_iterator it) {
+            *out++ = it != end;
+        });
+        return out;
+    }
+
     std::pair<iterator, iterator> equal_range(const key_type &key) {
         auto tmp = table.equal_range(key);
         return {iterator(tmp.first), iterator(tmp.second)};
@@ -251,6 +406,20 @@ public:
         return {const_iterator(tmp.first), const_iterator(tmp.second)};
     }
 
+    template<class K>
+    requires Table::transparent_lookup
+    std::pair<iterator, iterator> equal_range(const K &key) {
+        auto tmp = table.equal_range(key);
+        return {iterator(tmp.first), iterator(tmp.second)};
+    }
+
+    template<class K>
+    requires Table::transparent_lookup
+    std::pair<const_iterator, const_iterator> equal_range(const K &key) const {
+        auto tmp = table.equal_range(key);
+        return {const_iterator(tmp.first), const_iterator(tmp.second)};
+    }
+
     size_type bucket_count() const {
         return table.bucket_count();
     }
@@ -275,6 +444,10 @@ public:
         return table.max_load_factor();
     }
 
+    void max_load_factor(float ml) {
+        table.max_load_factor(ml);
+    }
+
     void rehash(const size_type count) {
         table.rehash(count);
     }
@@ -283,7 +456,53 @@ public:
         table.reserve(count);
     }
 
-    // compare two containers contents
+    // probe lengths, tombstones and rehash history, available with CollectStats
+    HashTableStats stats() const requires StatsPolicy::enabled {
+        return table.stats();
+    }
+
+    // set algebra, found by ADL: the smaller operand is iterated and the
+    // result reserved up front; rvalue operands give their slots up instead
+    // of being copied, see SetAlgebra
+    friend HashSet intersect(const HashSet &a, const HashSet &b) {
+        return HashSet(SetAlgebra<Table>::intersect(a.table, b.table));
+    }
+
+    friend HashSet intersect(HashSet &&a, const HashSet &b) {
+        return HashSet(SetAlgebra<Table>::intersect(std::move(a.table), b.table));
+    }
+
+    friend HashSet unite(const HashSet &a, const HashSet &b) {
+        return HashSet(SetAlgebra<Table>::unite(a.table, b.table));
+    }
+
+    friend HashSet unite(HashSet &&a, HashSet &&b) {
+        return HashSet(SetAlgebra<Table>::unite(std::move(a.table), std::move(b.table)));
+    }
+
+    // elements of `a` whose keys `b` lacks
+    friend HashSet difference(const HashSet &a, const HashSet &b) {
+        return HashSet(SetAlgebra<Table>::difference(a.table, b.table));
+    }
+
+    friend HashSet difference(HashSet &&a, const HashSet &b) {
+        return HashSet(SetAlgebra<Table>::difference(std::move(a.table), b.table));
+    }
+
+    // std::erase_if for HashSet, found by ADL: one sweep over the slot array
+    // calling `pred(const value_type &)`, see HashTable::erase_if
+    template<class Pred>
+    friend size_type erase_if(HashSet &set, Pred pred) {
+        return set.table.erase_if([&](const value_type &value) { return pred(value); });
+    }
+
+    // order-independent hash of the contents, updated on every insert and
+    // erase; also what std::hash of a HashSet returns
+    size_type fingerprint() const {
+        return table.fingerprint();
+    }
+
+    // same elements; sets of differing fingerprints are told apart in O(1)
     friend bool operator==(const HashSet &lhs, const HashSet &rhs) {
         return lhs.table == rhs.table;
     }
@@ -292,3 +511,25 @@ public:
         return lhs.table != rhs.table;
     }
 };
+
+// HashSet as a key of other hash containers, hashed in O(1); only for
+// stateless hashers, so that equal sets always hash alike
+template<class Key, class CollisionPolicy, class Hash, class Equal, class Storage, class IndexPolicy,
+        class StatsPolicy, class ResizePolicy, class Allocator>
+requires std::is_empty_v<Hash>
+struct std::hash<HashSet<Key, CollisionPolicy, Hash, Equal, Storage, IndexPolicy, StatsPolicy, ResizePolicy,
+        Allocator>> {
+    std::size_t operator()(const HashSet<Key, CollisionPolicy, Hash, Equal, Storage, IndexPolicy, StatsPolicy,
+            ResizePolicy, Allocator> &set) const noexcept {
+        return set.fingerprint();
+    }
+};
+
+namespace pmr {
+// HashSet allocating from a std::pmr::memory_resource, e.g. an arena
+template<class Key, class CollisionPolicy = LinearProbing, class Hash = std::hash<Key>,
+        class Equal = std::equal_to<Key>, class Storage = default_storage_t<Key, Hash>,
+        class IndexPolicy = PowerOfTwoMasking, class StatsPolicy = NoStats, class ResizePolicy = FullRehash>
+using HashSet = ::HashSet<Key, CollisionPolicy, Hash, Equal, Storage, IndexPolicy, StatsPolicy, ResizePolicy,
+        std::pmr::polymorphic_allocator<Key>>;
+}
@@ -1,56 +1,116 @@
 #pragma once
 
 #include "policy.h"
+#include "group.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
 #include <functional>
+#include <iterator>
 #include <vector>
 #include <utility>
-#include <typeinfo>
-#include <iostream>
+#include <type_traits>
 #include <memory>
+#include <stdexcept>
+#include <exception>
+#include <optional>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <atomic>
+#include <thread>
+
+// header of a table written by HashTable::save; the control bytes and the
+// slot array follow it as they are in memory, so the file can be mapped
+// and probed where it lies (see MappedHashTable)
+struct SavedTableHeader {
+    static constexpr char expected_magic[8] = {'H', 'a', 's', 'h', 'T', 'b', 'l', '1'};
+    static constexpr std::uint64_t expected_byte_order = 0x0102030405060708ull;
+    // arrays start on cache line boundaries of the file (and so of its mapping)
+    static constexpr std::uint64_t alignment = 64;
+
+    char magic[8];
+    std::uint64_t byte_order;
+    // fingerprint of the writer's policies, slot layout and hasher
+    std::uint64_t layout;
+    std::uint64_t size;
+    std::uint64_t bucket_count;
+    std::uint64_t ctrl_offset;
+    std::uint64_t slots_offset;
+    std::uint64_t file_size;
+};
+
+// trivially copyable, so valid wherever its bytes are copied to; std::pair
+// of such types counts too, though its assignment operators aren't trivial
+template<class T>
+constexpr bool is_bytewise_v = std::is_trivially_copyable_v<T>;
+
+template<class A, class B>
+constexpr bool is_bytewise_v<std::pair<A, B>> = is_bytewise_v<std::remove_const_t<A>> && is_bytewise_v<B>;
 
 template<
         class Key,
         class Value,
+        class KeyOf,
         class CollisionPolicy = LinearProbing,
         class Hash =  std::hash<Value>,
-        class Equal = std::equal_to<Value>
+        class Equal = std::equal_to<Value>,
+        class Storage = default_storage_t<Key, Hash>,
+        class IndexPolicy = PowerOfTwoMasking,
+        class StatsPolicy = NoStats,
+        class Allocator = std::allocator<Value>
 >
 class HashTable {
 private:
-    struct Element;
-
-    template<class T>
+    using slot_type = typename Storage::template Cell<Value>;
+    using alloc_traits = std::allocator_traits<Allocator>;
+    using value_allocator = typename alloc_traits::template rebind_alloc<Value>;
+    using element_allocator = storage_allocator_t<Storage, Value, value_allocator>;
+    using ctrl_vector = std::vector<ctrl_t, typename alloc_traits::template rebind_alloc<ctrl_t>>;
+    using slot_vector = std::vector<slot_type, typename alloc_traits::template rebind_alloc<slot_type>>;
+
+    template<class V>
     class HashTableIterator {
     private:
-        T cur_;
-        T end_;
+        using slot_pointer = std::conditional_t<std::is_const_v<V>, const slot_type *, slot_type *>;
+
+        const ctrl_t *ctrl_;
+        const ctrl_t *end_;
+        slot_pointer slot_;
+
+        friend HashTable;
     public:
         using iterator_category = std::forward_iterator_tag;
-        using value_type =  typename T::value_type;
+        using value_type = std::remove_const_t<V>;
         using difference_type = std::ptrdiff_t;
-        using pointer = typename T::pointer;
-        using reference = typename T::reference;
+        using pointer = V *;
+        using reference = V &;
 
-        HashTableIterator(T begin, T end) : cur_(begin), end_(end) {}
+        HashTableIterator(const ctrl_t *ctrl, const ctrl_t *end, slot_pointer slot) : ctrl_(ctrl), end_(end),
+                                                                                      slot_(slot) {}
 
-        HashTableIterator(const HashTableIterator<T> &other) = default;
+        HashTableIterator(const HashTableIterator &other) = default;
 
-        reference operator*() const {
-            return *cur_;
-        }
+        HashTableIterator &operator=(const HashTableIterator &other) = default;
 
-        T source() const {
-            return cur_;
+        reference operator*() const {
+            return *slot_->get();
         }
 
         pointer operator->() const {
-            return &*cur_;
+            return slot_->get();
         }
 
+        // the next slot is checked on its own first, dense tables rarely
+        // need more; runs of unused slots are skipped a group at a time
         HashTableIterator &operator++() {
-            do {
-                cur_++;
-            } while (cur_ != end_ && cur_->type != DATA);
+            ++ctrl_;
+            ++slot_;
+            if (ctrl_ != end_ && !is_full(*ctrl_)) {
+                const ctrl_t *next = next_full_ctrl(ctrl_, end_);
+                slot_ += next - ctrl_;
+                ctrl_ = next;
+            }
             return *this;
         }
 
@@ -68,16 +128,94 @@ private:
             return tmp;
         }
 
-        bool operator==(const HashTableIterator<T> &other) const {
-            return other.cur_ == cur_ && other.end_ == end_;
+        bool operator==(const HashTableIterator &other) const {
+            return other.ctrl_ == ctrl_;
         }
 
-        bool operator!=(const HashTableIterator<T> &other) const {
+        bool operator!=(const HashTableIterator &other) const {
             return !(*this == other);
         }
 
-        operator HashTableIterator<typename std::vector<Element>::const_iterator>() const {
-            return const_iterator(cur_, end_);
+        operator HashTableIterator<const V>() const {
+            return HashTableIterator<const V>(ctrl_, end_, slot_);
+        }
+    };
+
+    // element taken out of a table by extract, owned until it is inserted
+    // into a table of the same type; it keeps a slot of its own, cached hash
+    // included, so under NodeStorage the node itself changes hands. Empty
+    // once inserted or moved from
+    class NodeHandle {
+    private:
+        slot_type cell_;
+        std::optional<value_allocator> alloc_;
+
+        friend HashTable;
+
+        void take(NodeHandle &other) {
+            if (other.alloc_) {
+                cell_.relocate(*other.alloc_, other.cell_);
+                alloc_.emplace(std::move(*other.alloc_));
+                other.alloc_.reset();
+            }
+        }
+
+        void reset() noexcept {
+            if (alloc_) {
+                cell_.destroy(*alloc_);
+                alloc_.reset();
+            }
+        }
+    public:
+        using value_type = Value;
+        using allocator_type = Allocator;
+
+        NodeHandle() noexcept = default;
+
+        NodeHandle(NodeHandle &&other) noexcept(noexcept(std::declval<slot_type &>().relocate(
+                std::declval<value_allocator &>(), std::declval<slot_type &>()))) {
+            take(other);
+        }
+
+        NodeHandle &operator=(NodeHandle &&other) {
+            if (this != &other) {
+                reset();
+                take(other);
+            }
+            return *this;
+        }
+
+        ~NodeHandle() {
+            reset();
+        }
+
+        bool empty() const noexcept {
+            return !alloc_;
+        }
+
+        explicit operator bool() const noexcept {
+            return !empty();
+        }
+
+        allocator_type get_allocator() const {
+            return allocator_type(*alloc_);
+        }
+
+        value_type &value() {
+            return *cell_.get();
+        }
+
+        const value_type &value() const {
+            return *cell_.get();
+        }
+
+        // keys of map nodes can't be changed in place, unlike std's
+        const auto &key() const requires requires(const Value &v) { v.first; } {
+            return value().first;
+        }
+
+        auto &mapped() requires requires(Value &v) { v.second; } {
+            return value().second;
         }
     };
 
@@ -88,87 +226,153 @@ public:
     using difference_type = std::ptrdiff_t;
     using hasher = Hash;
     using key_equal = Equal;
+    using allocator_type = Allocator;
     using reference = value_type &;
     using const_reference = const value_type &;
     using pointer = value_type *;
     using const_pointer = const value_type *;
 
-    using iterator = HashTableIterator<typename std::vector<Element>::iterator>;
-    using const_iterator = HashTableIterator<typename std::vector<Element>::const_iterator>;
+    using iterator = HashTableIterator<value_type>;
+    using const_iterator = HashTableIterator<const value_type>;
+    using node_type = NodeHandle;
 
-    explicit HashTable(std::function<const key_type &(const_reference)> getKV,
-                       size_type expected_max_size = 1,
+    struct insert_return_type {
+        iterator position;
+        bool inserted;
+        node_type node;
+    };
+
+    // both hasher and key_equal declare `is_transparent`: lookups accept any
+    // type they can hash and compare with key_type, without converting it
+    static constexpr bool transparent_lookup = requires {
+        typename Hash::is_transparent;
+        typename Equal::is_transparent;
+    };
+
+    explicit HashTable(size_type expected_max_size = 1,
                        const hasher &hash = hasher(),
-                       const key_equal &equal = key_equal()) : hash_(hash), equal_(equal),
-                                                               data_(optimal_size(
-                                                                       expected_max_size / max_load_factor_)),
-                                                               key_from_value_(getKV) {
+                       const key_equal &equal = key_equal(),
+                       const KeyOf &key_of = KeyOf(),
+                       const allocator_type &alloc = allocator_type()) : HashTable(no_slots_t(), hash, equal, key_of,
+                                                                                   alloc) {
+        allocate(capacity_for(expected_max_size));
     }
 
+    explicit HashTable(const allocator_type &alloc) : HashTable(1, hasher(), key_equal(), KeyOf(), alloc) {}
+
     template<class InputIt>
     HashTable(InputIt first, InputIt last,
-              std::function<const key_type &(const_reference)> getKV,
               size_type expected_max_size = 1,
               const hasher &hash = hasher(),
-              const key_equal &equal = key_equal()) : hash_(hash), equal_(equal),
-                                                      data_(optimal_size(expected_max_size / max_load_factor_)),
-                                                      key_from_value_(getKV) {
+              const key_equal &equal = key_equal(),
+              const KeyOf &key_of = KeyOf(),
+              const allocator_type &alloc = allocator_type()) : HashTable(expected_max_size, hash, equal, key_of,
+                                                                          alloc) {
         for (auto i = first; i != last; i++) {
             insert(*i);
         }
     }
 
-    HashTable(const HashTable &o) = default;
+    HashTable(const HashTable &o) : HashTable(o, alloc_traits::select_on_container_copy_construction(
+            o.get_allocator())) {}
+
+    HashTable(const HashTable &o, const allocator_type &alloc) : HashTable(no_slots_t(), o.hash_, o.equal_,
+                                                                           o.key_of_, alloc) {
+        max_load_factor_ = o.max_load_factor_;
+        copy_slots<false>(o);
+    }
 
-    HashTable(HashTable &&o) noexcept = default;
+    HashTable(HashTable &&o) noexcept: hash_(std::move(o.hash_)), equal_(std::move(o.equal_)),
+                                       key_of_(std::move(o.key_of_)), alloc_(std::move(o.alloc_)),
+                                       stats_(std::move(o.stats_)), ctrl_(std::move(o.ctrl_)),
+                                       slots_(std::move(o.slots_)), size_(o.size_), cells_cnt_(o.cells_cnt_),
+                                       fingerprint_(o.fingerprint_), first_full_(o.first_full_),
+                                       max_load_factor_(o.max_load_factor_) {
+        o.ctrl_.clear();
+        o.slots_.clear();
+        o.size_ = 0;
+        o.cells_cnt_ = 0;
+        o.fingerprint_ = 0;
+        o.first_full_ = 0;
+    }
+
+    // steals `o`'s arrays if its allocator equals `alloc`, otherwise moves
+    // its elements one by one into memory from `alloc`
+    HashTable(HashTable &&o, const allocator_type &alloc) : HashTable(no_slots_t(), o.hash_, o.equal_, o.key_of_,
+                                                                      alloc) {
+        max_load_factor_ = o.max_load_factor_;
+        if (get_allocator() == o.get_allocator()) {
+            swap(std::move(o));
+        } else {
+            copy_slots<true>(o);
+        }
+    }
 
     HashTable(std::initializer_list<value_type> init,
-              std::function<const key_type &(const_reference)> getKV,
               size_type expected_max_size = 1,
               const hasher &hash = hasher(),
-              const key_equal &equal = key_equal()) : hash_(hash), equal_(equal),
-                                                      data_(expected_max_size / max_load_factor_), key_from_value_(getKV) {
+              const key_equal &equal = key_equal(),
+              const KeyOf &key_of = KeyOf(),
+              const allocator_type &alloc = allocator_type()) : HashTable(std::max(expected_max_size, init.size()),
+                                                                          hash, equal, key_of, alloc) {
         insert(init);
     }
 
+    ~HashTable() {
+        destroy_all();
+    }
+
+    // the allocator of this table is kept unless it propagates on copy/move
+    // assignment, like the std containers do
     HashTable &operator=(const HashTable &other) {
-        HashTable tmp(other);
-        swap(tmp);
+        if (this != &other) {
+            HashTable tmp(other, alloc_traits::propagate_on_container_copy_assignment::value
+                                 ? other.get_allocator() : get_allocator());
+            swap(std::move(tmp));
+        }
         return *this;
     }
 
-    HashTable &operator=(HashTable &&other) noexcept {
-        swap(std::move(other));
+    HashTable &operator=(HashTable &&other) noexcept(alloc_traits::propagate_on_container_move_assignment::value ||
+                                                     alloc_traits::is_always_equal::value) {
+        if constexpr (alloc_traits::propagate_on_container_move_assignment::value ||
+                      alloc_traits::is_always_equal::value) {
+            swap(std::move(other));
+        } else {
+            HashTable tmp(std::move(other), get_allocator());
+            swap(std::move(tmp));
+        }
         return *this;
     };
 
     HashTable &operator=(std::initializer_list<value_type> init) {
         clear();
         insert(init);
+        return *this;
     }
 
     iterator begin() noexcept {
-        return iterator(find_begin(), data_.end());
+        return iterator_at(first_full_);
     }
 
     const_iterator begin() const noexcept {
-        return const_iterator(find_begin(), data_.end());
+        return iterator_at(first_full_);
     }
 
     const_iterator cbegin() const noexcept {
-        return const_iterator(find_begin(), data_.end());
+        return begin();
     }
 
     iterator end() noexcept {
-        return iterator(data_.end(), data_.end());
+        return iterator_at(bucket_count());
     }
 
     const_iterator end() const noexcept {
-        return const_iterator(data_.end(), data_.end());
+        return iterator_at(bucket_count());
     }
 
     const_iterator cend() const noexcept {
-        return const_iterator(data_.end(), data_.end());
+        return end();
     }
 
     bool empty() const {
@@ -180,14 +384,24 @@ public:
     }
 
     size_type max_size() const {
-        return data_.max_size() * max_load_factor_;
+        return slots_.max_size() * max_load_factor_;
+    }
+
+    allocator_type get_allocator() const {
+        return allocator_type(ctrl_.get_allocator());
+    }
+
+    hasher hash_function() const {
+        return hash_;
+    }
+
+    key_equal key_eq() const {
+        return equal_;
     }
 
     void clear() {
-        data_.clear();
-        data_.resize(8);
-        size_ = 0;
-        cells_cnt_ = 0;
+        destroy_all();
+        allocate(min_bucket_count_);
     };
 
 
@@ -222,25 +436,119 @@ public:
         }
     }
 
+    // insert(first, last), but hashing and prefetching a batch ahead, see find_batch
+    template<std::forward_iterator It>
+    void insert_batch(It first, It last) {
+        for_each_batch(first, last, [&](const auto &value) {
+            return prefetched_hash(key_of_(value));
+        }, [&](const auto &value, size_type hash) {
+            insert_with(key_of_(value), hash, [&](slot_type &slot) {
+                slot.construct(alloc_, value);
+            });
+        });
+    }
+
+    // writes the table in the SavedTableHeader format for MappedHashTable:
+    // the header, then the control bytes and the slot array as they are, with
+    // unused slots zeroed; only for flat storage of trivially copyable keys
+    // and values. Errors are reported through the stream's state
+    void save(std::ostream &out) const requires (requires { requires Storage::in_place; } && is_bytewise_v<Value>) {
+        constexpr std::uint64_t align = SavedTableHeader::alignment;
+        static_assert(alignof(slot_type) <= align);
+        auto aligned = [](std::uint64_t offset) { return (offset + align - 1) / align * align; };
+        SavedTableHeader header{};
+        std::memcpy(header.magic, SavedTableHeader::expected_magic, sizeof(header.magic));
+        header.byte_order = SavedTableHeader::expected_byte_order;
+        header.layout = layout_signature();
+        header.size = size_;
+        header.bucket_count = bucket_count();
+        header.ctrl_offset = aligned(sizeof(header));
+        header.slots_offset = aligned(header.ctrl_offset + bucket_count());
+        header.file_size = header.slots_offset + bucket_count() * sizeof(slot_type);
+        const char zeros[align] = {};
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(zeros, static_cast<std::streamsize>(header.ctrl_offset - sizeof(header)));
+        out.write(reinterpret_cast<const char *>(ctrl_.data()), static_cast<std::streamsize>(bucket_count()));
+        out.write(zeros, static_cast<std::streamsize>(header.slots_offset - header.ctrl_offset - bucket_count()));
+        // a chunk at a time, so unused slots don't write out whatever the heap had there
+        constexpr size_type chunk = 4096;
+        std::vector<char> buffer(chunk * sizeof(slot_type));
+        for (size_type first = 0; first < bucket_count() && out; first += chunk) {
+            size_type n = std::min(chunk, bucket_count() - first);
+            for (size_type i = 0; i < n; ++i) {
+                char *dst = buffer.data() + i * sizeof(slot_type);
+                if (is_full(ctrl_[first + i])) {
+                    std::memcpy(dst, static_cast<const void *>(&slots_[first + i]), sizeof(slot_type));
+                } else {
+                    std::memset(dst, 0, sizeof(slot_type));
+                }
+            }
+            out.write(buffer.data(), static_cast<std::streamsize>(n * sizeof(slot_type)));
+        }
+    }
+
+    // insert(first, last) from `threads` threads (hardware_concurrency() when 0):
+    // the home slots are split into contiguous regions, the input is bucketed
+    // by the region its hash falls into, and each thread fills whole regions,
+    // touching no slot outside of them; the few elements whose probe would
+    // leave their region are inserted afterwards by the calling thread.
+    // Like insert, the first of equal keys wins. Hasher, key_equal and the
+    // element constructor run concurrently; robin hood tables, node pools
+    // and stateful allocators (which need not be thread-safe) insert serially
+    template<std::random_access_iterator It>
+    void parallel_insert(It first, It last, size_type threads = 0) {
+        size_type n = last - first;
+        reserve(size_ + n);
+        threads = thread_count(threads, std::min(n, home_count()));
+        if constexpr (parallel_build_) {
+            if (threads > 1) {
+                parallel_build(first, n, threads);
+                return;
+            }
+        }
+        insert_batch(first, last);
+    }
+
+    // calls `f(value_type &)` on every element from `threads` threads
+    // (hardware_concurrency() when 0), each walking its own contiguous range
+    // of slots; `f` runs concurrently and must not insert or erase
+    template<class F>
+    void parallel_for_each(F &&f, size_type threads = 0) {
+        parallel_for_each_impl(*this, f, threads);
+    }
+
+    template<class F>
+    void parallel_for_each(F &&f, size_type threads = 0) const {
+        parallel_for_each_impl(*this, f, threads);
+    }
 
     // construct element in-place, no copy or move operations are performed;
     // element's constructor is called with exact same arguments as `emplace` method
     // (using `std::forward<Args>(args)...`)
     template<class... Args>
     std::pair<iterator, bool> emplace(Args &&... args) {
-        check_size();
-        Element tmp = Element(std::make_unique<value_type>(std::forward<Args>(args)...));
-        size_type hash = hash_(key_from_value_(tmp.data())) % data_.size();
-        auto it = CollisionPolicy(data_.size(), hash);
-        for (; data_[*it].type != FREE; ++it) {
-            if (data_[*it].type == DATA && equal_(key_from_value_(data_[*it].data()), key_from_value_(tmp.data()))) {
-                return {iterator(data_.begin() + *it, data_.end()), false};
-            }
+        if constexpr (sizeof...(Args) == 1 && (std::is_same_v<std::remove_cvref_t<Args>, value_type> && ...)) {
+            return emplace_key(key_of_(args)..., std::forward<Args>(args)...);
+        } else {
+            // the key is only known once the element exists
+            Holder tmp(alloc_, std::forward<Args>(args)...);
+            const auto &key = key_of_(tmp.value());
+            auto [id, inserted] = insert_with(key, hash_of(key), [&](slot_type &slot) {
+                tmp.move_to(slot);
+            });
+            return {iterator_at(id), inserted};
         }
-        data_[*it] = std::move(tmp);
-        ++size_;
-        ++cells_cnt_;
-        return {iterator(data_.begin() + *it, data_.end()), true};
+    }
+
+    // inserts an element constructed from `args` unless `key` is already
+    // present; one probe decides, and nothing is constructed on a hit;
+    // the constructed element must have a key equal to `key`
+    template<class K, class... Args>
+    std::pair<iterator, bool> emplace_key(const K &key, Args &&... args) {
+        auto [id, inserted] = insert_with(key, hash_of(key), [&](slot_type &slot) {
+            slot.construct(alloc_, std::forward<Args>(args)...);
+        });
+        return {iterator_at(id), inserted};
     }
 
     template<class... Args>
@@ -249,69 +557,232 @@ public:
     }
 
     iterator erase(const_iterator pos) {
-        size_type id = pos.source() - data_.begin();
-        auto res = iterator(data_.begin() + id, data_.end()) + 1;
-        data_[id].free();
-        size_--;
-        return res;
+        size_type id = pos.ctrl_ - ctrl_.data();
+        erase_at(id);
+        // robin hood erase may have shifted the next element into this slot
+        return iterator_at(next_full(id));
     }
 
     iterator erase(const_iterator first, const_iterator last) {
-        size_type id = last.source() - data_.begin();
-        auto res = iterator(data_.begin() + id, data_.end()) + 1;
-        for (auto i = first; i != last; ++i) {
-            erase(i);
+        auto n = std::distance(first, last);
+        iterator res = mutable_iterator(first);
+        for (; n > 0; --n) {
+            res = erase(res);
         }
         return res;
     }
 
     iterator find(const key_type &key) {
-        auto hash = hash_(key);
-        auto it = CollisionPolicy(data_.size(), hash);
-        for (; data_[*it].type != FREE; ++it) {
-            if (data_[*it].type == DATA && equal_(key_from_value_(data_[*it].data()), key)) {
-                return iterator(data_.begin() + *it, data_.end());
-            }
-        }
-        return end();
+        return iterator_at(index_or_end(find_index(key, hash_of(key))));
     }
 
     const_iterator find(const key_type &key) const {
-        auto hash = hash_(key);
-        auto it = CollisionPolicy(data_.size(), hash);
-        for (; data_[*it].type != FREE; ++it) {
-            if (data_[*it].type == DATA && equal_(key_from_value_(data_[*it].data()), key)) {
-                return const_iterator(data_.begin() + *it, data_.end());
+        return iterator_at(index_or_end(find_index(key, hash_of(key))));
+    }
+
+    template<class K>
+    requires transparent_lookup
+    iterator find(const K &key) {
+        return iterator_at(index_or_end(find_index(key, hash_of(key))));
+    }
+
+    template<class K>
+    requires transparent_lookup
+    const_iterator find(const K &key) const {
+        return iterator_at(index_or_end(find_index(key, hash_of(key))));
+    }
+
+    // looks up every key of [first, last) and passes `found` its iterator
+    // (or end()), in order; keys are hashed and their home slots prefetched
+    // `batch_size_` at a time before any of them is probed, so cache misses
+    // of the whole batch are waited for together instead of one by one
+    template<std::forward_iterator It, class Found>
+    void find_batch(It first, It last, Found &&found) {
+        for_each_batch(first, last, [&](const auto &key) {
+            return prefetched_hash(key);
+        }, [&](const auto &key, size_type hash) {
+            found(iterator_at(index_or_end(find_index(key, hash))));
+        });
+    }
+
+    template<std::forward_iterator It, class Found>
+    void find_batch(It first, It last, Found &&found) const {
+        for_each_batch(first, last, [&](const auto &key) {
+            return prefetched_hash(key);
+        }, [&](const auto &key, size_type hash) {
+            found(iterator_at(index_or_end(find_index(key, hash))));
+        });
+    }
+
+
+    size_type erase(const key_type &key) {
+        return erase_key(key);
+    }
+
+    template<class K>
+    requires (transparent_lookup && !std::is_convertible_v<K, iterator> && !std::is_convertible_v<K, const_iterator>)
+    size_type erase(K &&key) {
+        return erase_key(key);
+    }
+
+    // erases every element `pred(value_type &)` holds for in one pass over
+    // the slot array, without probing or allocating; returns how many.
+    // Robin hood tables shift the kept elements of each run back over the
+    // gaps as they go, so the result is as compact as if those elements had
+    // been inserted alone; under linear probing, tombstones that end a run
+    // are freed afterwards. If `pred` throws, the elements it was not asked
+    // about yet are kept
+    template<class Pred>
+    size_type erase_if(Pred &&pred) {
+        size_type removed = 0;
+        if constexpr (robin_hood_) {
+            // where the next kept element may move back to, at best
+            size_type write = 0;
+            auto keep = [&](size_type i) {
+                size_type home = i - distance_at(i);
+                size_type target = std::max(write, home);
+                if (target != i) {
+                    slots_[target].relocate(alloc_, slots_[i]);
+                    ctrl_[target] = distance_byte(target - home);
+                    ctrl_[i] = CTRL_FREE;
+                }
+                write = target + 1;
+            };
+            for (size_type i = next_full(first_full_); i < bucket_count(); i = next_full(i + 1)) {
+                bool erase;
+                try {
+                    erase = pred(*slots_[i].get());
+                } catch (...) {
+                    // a gap must not be left inside the run
+                    for (; i < bucket_count() && is_full(ctrl_[i]); ++i) {
+                        keep(i);
+                    }
+                    first_full_ = next_full(first_full_);
+                    throw;
+                }
+                if (erase) {
+                    fingerprint_ -= print_of(stored_hash(slots_[i]));
+                    slots_[i].destroy(alloc_);
+                    ctrl_[i] = CTRL_FREE;
+                    --size_;
+                    --cells_cnt_;
+                    ++removed;
+                } else {
+                    keep(i);
+                }
+            }
+        } else {
+            try {
+                for (size_type i = next_full(first_full_); i < bucket_count(); i = next_full(i + 1)) {
+                    if (pred(*slots_[i].get())) {
+                        fingerprint_ -= print_of(stored_hash(slots_[i]));
+                        slots_[i].destroy(alloc_);
+                        clear_slot(i);
+                        ++removed;
+                    }
+                }
+            } catch (...) {
+                first_full_ = next_full(first_full_);
+                throw;
+            }
+            if constexpr (std::is_same_v<CollisionPolicy, LinearProbing>) {
+                if (cells_cnt_ != size_) {
+                    free_run_tombstones();
+                }
             }
         }
-        return cend();
+        if (removed != 0) {
+            first_full_ = next_full(first_full_);
+        }
+        return removed;
     }
 
+    // unlinks the element at `pos` without destroying it, see NodeHandle
+    node_type extract(const_iterator pos) {
+        size_type id = pos.ctrl_ - ctrl_.data();
+        size_type hash = stored_hash(slots_[id]);
+        node_type node = release_cell(slots_[id]);
+        remove_at(id, hash);
+        return node;
+    }
 
-    size_type erase(const key_type &key) {
-        auto it = find(key);
-        size_type cnt = 0;
-        do {
-            erase(it);
-            it = find(key);
-            cnt++;
-        } while (it != end());
-        return cnt;
+    node_type extract(const key_type &key) {
+        return extract_key(key);
+    }
+
+    template<class K>
+    requires (transparent_lookup && !std::is_convertible_v<K, iterator> && !std::is_convertible_v<K, const_iterator>)
+    node_type extract(K &&key) {
+        return extract_key(key);
+    }
+
+    // inserts the element of `node` unless its key is present, in which
+    // case the node is handed back; the element is moved only if `node`
+    // comes from another allocator or this table pools its nodes, and its
+    // cached hash is reused
+    insert_return_type insert(node_type &&node) {
+        if (node.empty()) {
+            return {end(), false, node_type()};
+        }
+        auto [id, inserted] = insert_node(node, node_hash(node));
+        if (!inserted) {
+            return {iterator_at(id), false, std::move(node)};
+        }
+        return {iterator_at(id), true, node_type()};
+    }
+
+    // moves the elements of `source` whose keys are absent here into this
+    // table, slot to slot, like inserting their extracted nodes would; the
+    // others stay in `source`. Room for all of `source` is made up front
+    void merge(HashTable &source) {
+        if (&source == this || source.empty()) {
+            return;
+        }
+        reserve(size_ + source.size_);
+        for (size_type i = source.first_full_; i < source.bucket_count();) {
+            if (!is_full(source.ctrl_[i])) {
+                i = source.next_full(i);
+            } else if (!take(source, source.iterator_at(i)).second || !robin_hood_) {
+                // robin hood erase shifts the next element into `i`
+                ++i;
+            }
+        }
+    }
+
+    void merge(HashTable &&source) {
+        merge(source);
     }
 
     // exchanges the contents of the container with those of other;
     // does not invoke any move, copy, or swap operations on individual elements
     void swap(HashTable &&other) noexcept {
-        std::swap(other.data_, data_);
+        // pooled nodes belong to their pool, which has to go along with them
+        if constexpr (table_owned_nodes_) {
+            alloc_.swap(other.alloc_);
+        } else if constexpr (alloc_traits::propagate_on_container_swap::value) {
+            std::swap(other.alloc_, alloc_);
+        }
+        std::swap(other.ctrl_, ctrl_);
+        std::swap(other.slots_, slots_);
         std::swap(other.equal_, equal_);
         std::swap(other.hash_, hash_);
         std::swap(other.size_, size_);
         std::swap(other.cells_cnt_, cells_cnt_);
-        std::swap(other.key_from_value_, key_from_value_);
+        std::swap(other.fingerprint_, fingerprint_);
+        std::swap(other.first_full_, first_full_);
+        std::swap(other.key_of_, key_of_);
+        std::swap(other.stats_, stats_);
+        std::swap(other.max_load_factor_, max_load_factor_);
     }
 
     size_type count(const key_type &key) const {
-        return find(key) != end() ? 1 : 0;
+        return find_index(key, hash_of(key)) != npos ? 1 : 0;
+    }
+
+    template<class K>
+    requires transparent_lookup
+    size_type count(const K &key) const {
+        return find_index(key, hash_of(key)) != npos ? 1 : 0;
     }
 
 
@@ -319,23 +790,43 @@ public:
         return count(key) == 1;
     }
 
+    template<class K>
+    requires transparent_lookup
+    bool contains(const K &key) const {
+        return count(key) == 1;
+    }
+
     std::pair<iterator, iterator> equal_range(const key_type &key) {
         auto tmp = find(key);
-        return tmp == end() ? make_pair(end(), end()) : make_pair(tmp, tmp + 1);
+        return tmp == end() ? std::make_pair(end(), end()) : std::make_pair(tmp, tmp + 1);
     }
 
     std::pair<const_iterator, const_iterator> equal_range(const key_type &key) const {
         auto tmp = find(key);
-        return tmp == cend() ? make_pair(end(), end()) : make_pair(tmp, tmp + 1);
+        return tmp == cend() ? std::make_pair(cend(), cend()) : std::make_pair(tmp, tmp + 1);
     };
 
+    template<class K>
+    requires transparent_lookup
+    std::pair<iterator, iterator> equal_range(const K &key) {
+        auto tmp = find(key);
+        return tmp == end() ? std::make_pair(end(), end()) : std::make_pair(tmp, tmp + 1);
+    }
+
+    template<class K>
+    requires transparent_lookup
+    std::pair<const_iterator, const_iterator> equal_range(const K &key) const {
+        auto tmp = find(key);
+        return tmp == cend() ? std::make_pair(cend(), cend()) : std::make_pair(tmp, tmp + 1);
+    }
+
 
     size_type bucket_count() const {
-        return data_.size();
+        return ctrl_.size();
     }
 
     size_type max_bucket_count() const {
-        return data_.max_size();
+        return slots_.max_size();
     }
 
     size_type bucket_size(const size_type) const {
@@ -343,42 +834,90 @@ public:
     }
 
     size_type bucket(const key_type &key) const {
-        return std::distance(data_.begin(), find(key).source());
+        return home_of(hash_of(key));
     }
 
     float load_factor() const {
-        return size_ * 1. / data_.size();
+        return size_ * 1. / bucket_count();
     }
 
     float max_load_factor() const {
         return max_load_factor_;
     }
 
-    void rehash(size_type count) {
-        if (count == bucket_count()) return;
-        if (count < size() / max_load_factor()) {
-            count = size() / max_load_factor();
+    // sets the load factor the table grows at, defaults to the collision
+    // policy's `max_load_factor`; an open addressing table needs it below 1;
+    // rehashes only if the current elements no longer fit
+    void max_load_factor(float ml) {
+        if (!(ml > 0 && ml < 1)) {
+            throw std::invalid_argument("HashTable: max_load_factor must be in (0, 1)");
         }
-        std::vector<Element> old(count);
-        std::swap(old, data_);
-        size_ = 0;
-        cells_cnt_ = 0;
-        for (auto &el: old) {
-            if (el.type == DATA) {
-                insert(el);
+        max_load_factor_ = ml;
+        if (cells_cnt_ > max_load_factor_ * home_count()) {
+            rehash(0);
+        }
+    }
+
+    void rehash(size_type count) {
+        count = std::max(capacity_for_buckets(count), capacity_for(size_));
+        if (count == home_count()) {
+            if (cells_cnt_ != size_) {
+                drop_tombstones();
             }
+            return;
         }
+        rehash_to(count);
     }
 
     void reserve(size_type count) {
-        rehash(optimal_size(count / max_load_factor()));
+        rehash(capacity_for(count));
     }
 
-    // compare two containers contents
+    // walks the whole table, meant for diagnostics rather than hot paths
+    HashTableStats stats() const requires StatsPolicy::enabled {
+        HashTableStats res;
+        res.size = size_;
+        res.bucket_count = bucket_count();
+        res.tombstones = cells_cnt_ - size_;
+        res.load_factor = load_factor();
+        size_type total = 0;
+        for (size_type i = 0; i < bucket_count(); ++i) {
+            if (is_full(ctrl_[i])) {
+                size_type len = probe_length(i);
+                if (res.probe_lengths.size() < len) {
+                    res.probe_lengths.resize(len);
+                }
+                ++res.probe_lengths[len - 1];
+                total += len;
+            }
+        }
+        res.longest_probe = res.probe_lengths.size();
+        res.mean_probe = size_ == 0 ? 0 : total * 1. / size_;
+        res.rehash_count = stats_.rehash_count;
+        res.rehash_time = stats_.rehash_time;
+        return res;
+    }
+
+    // order-independent hash of the keys, kept up to date by every insert
+    // and erase: equal tables have equal fingerprints as long as their
+    // hashers agree, which stateless ones always do. Mapped values aren't
+    // covered, they change in place behind the table's back
+    size_type fingerprint() const {
+        return fingerprint_;
+    }
+
+    // same keys, and values of equal keys compare equal too (their mapped
+    // parts for pairs); differing fingerprints end it early, and every key
+    // of `lhs` is looked for in `rhs` with its stored hash
     friend bool operator==(const HashTable &lhs, const HashTable &rhs) {
         if (lhs.size() != rhs.size()) return false;
-        for (auto const &el: lhs) {
-            if (!rhs.contains(lhs.key_from_value_(el.data()))) {
+        if constexpr (std::is_empty_v<hasher>) {
+            if (lhs.fingerprint_ != rhs.fingerprint_) return false;
+        }
+        for (size_type i = lhs.next_full(lhs.first_full_); i < lhs.bucket_count(); i = lhs.next_full(i + 1)) {
+            const slot_type &slot = lhs.slots_[i];
+            size_type id = rhs.find_index(lhs.key_of_(*slot.get()), rhs.foreign_hash(slot));
+            if (id == npos || !same_value(*slot.get(), *rhs.slots_[id].get())) {
                 return false;
             }
         }
@@ -390,119 +929,1370 @@ public:
     }
 
 private:
-    typename std::vector<Element>::iterator find_begin() {
-        auto it = data_.begin();
-        while (it != data_.end()) {
-            if (it->type == DATA)
-                return it;
-            it++;
+    template<class, class, class, class, class, class, class, class, class, class, std::size_t>
+    friend class IncrementalHashTable;
+
+    template<class, class, class, class, class, class, class, class, class, class, std::size_t>
+    friend class SmallHashTable;
+
+    template<class, class, class, class, class, class, class, class, class>
+    friend class ConcurrentHashMap;
+
+    template<class>
+    friend class MappedHashTable;
+
+    template<class>
+    friend struct SetAlgebra;
+
+    // tag of the constructor making a table without any slots, like a moved-from one
+    struct no_slots_t {
+    };
+
+    HashTable(no_slots_t, const hasher &hash, const key_equal &equal, const KeyOf &key_of,
+              const allocator_type &alloc) : hash_(hash), equal_(equal), key_of_(key_of), alloc_(alloc),
+                                             ctrl_(typename ctrl_vector::allocator_type(alloc)),
+                                             slots_(typename slot_vector::allocator_type(alloc)) {}
+
+    // fills this table, which has no slots yet, with copies of `o`'s elements
+    // (or moved `o`'s elements), keeping their slots
+    template<bool Move>
+    void copy_slots(std::conditional_t<Move, HashTable, const HashTable> &o) {
+        allocate(o.home_count(), o.bucket_count() - o.home_count());
+        try {
+            for (size_type i = 0; i < o.bucket_count(); ++i) {
+                if (is_full(o.ctrl_[i])) {
+                    if constexpr (Move) {
+                        slots_[i].construct(alloc_, std::move(*o.slots_[i].get()));
+                    } else {
+                        slots_[i].construct(alloc_, *o.slots_[i].get());
+                    }
+                    if constexpr (cached_hash_) {
+                        slots_[i].set_hash(o.slots_[i].hash());
+                    }
+                    ++size_;
+                }
+                // tombstones are kept too, elements behind them are only reachable through them
+                ctrl_[i] = o.ctrl_[i];
+            }
+        } catch (...) {
+            destroy_all();
+            throw;
         }
-        return it;
+        cells_cnt_ = o.cells_cnt_;
+        fingerprint_ = o.fingerprint_;
+        first_full_ = o.first_full_;
     }
 
-    typename std::vector<Element>::const_iterator find_begin() const {
-        auto it = data_.begin();
-        while (it != data_.end()) {
-            if (it->type == DATA)
-                return it;
-            it++;
+    // value constructed outside of the table, owned until it is moved into a slot
+    class Holder {
+    private:
+        element_allocator &alloc_;
+        slot_type cell_;
+        bool live_ = false;
+    public:
+        template<class... Args>
+        explicit Holder(element_allocator &alloc, Args &&... args) : alloc_(alloc) {
+            cell_.construct(alloc_, std::forward<Args>(args)...);
+            live_ = true;
         }
-        return it;
-    }
 
-    enum ElementType {
-        FREE, DELETED, DATA
+        Holder(const Holder &) = delete;
+
+        Holder &operator=(const Holder &) = delete;
+
+        ~Holder() {
+            if (live_) {
+                cell_.destroy(alloc_);
+            }
+        }
+
+        value_type &value() {
+            return *cell_.get();
+        }
+
+        void move_to(slot_type &slot) {
+            slot.relocate(alloc_, cell_);
+            live_ = false;
+        }
     };
 
-    struct Element {
-        using Type = value_type;
-        ElementType type;
-        std::unique_ptr<Type> ptr;
+    template<class P>
+    static constexpr float policy_load_factor() {
+        if constexpr (requires { P::max_load_factor; }) {
+            return P::max_load_factor;
+        } else {
+            return 0.5;
+        }
+    }
+
+    template<class P>
+    static constexpr size_type policy_group_width() {
+        if constexpr (requires { P::group_width; }) {
+            return P::group_width;
+        } else {
+            return 1;
+        }
+    }
 
-        Element() : type(FREE) {}
+    template<class P>
+    static constexpr bool policy_robin_hood() {
+        if constexpr (requires { P::robin_hood; }) {
+            return P::robin_hood;
+        } else {
+            return false;
+        }
+    }
 
-        Element(std::unique_ptr<Type> data) : type(DATA), ptr(std::move(data)) {}
+    static constexpr size_type npos = static_cast<size_type>(-1);
+    static constexpr bool robin_hood_ = policy_robin_hood<CollisionPolicy>();
+    // robin hood control bytes hold probe distances up to this one; farther
+    // elements keep it too, their distance is recomputed from their hash
+    static constexpr ctrl_t max_distance_ = 127;
+    static constexpr size_type group_width_ = policy_group_width<CollisionPolicy>();
+    static constexpr bool nothrow_relocate_ = noexcept(std::declval<slot_type &>().relocate(
+            std::declval<element_allocator &>(), std::declval<slot_type &>()));
+    static constexpr size_type min_bucket_count_ = std::max<size_type>(8, group_width_);
+    static constexpr bool cached_hash_ = requires { requires Storage::caches_hash; };
+    // stored_hash() can't throw
+    static constexpr bool nothrow_stored_hash_ = cached_hash_ ||
+            (std::is_nothrow_invocable_v<const KeyOf &, const value_type &> &&
+             std::is_nothrow_invocable_v<const hasher &, const key_type &>);
+    // elements come from a node pool of this very table
+    static constexpr bool table_owned_nodes_ = !std::is_same_v<element_allocator, value_allocator>;
+    // enough lookups in flight to cover a DRAM miss, few enough to stay in L1
+    static constexpr size_type batch_size_ = 16;
+    // fewest slots or elements worth a thread of their own
+    static constexpr size_type parallel_grain_ = 1 << 14;
+    // regions of the slot array can be filled concurrently: no robin hood
+    // shifts across them, and nothing shared is allocated from
+    static constexpr bool parallel_build_ = !robin_hood_ && !table_owned_nodes_ &&
+                                            alloc_traits::is_always_equal::value;
+
+    // tells apart tables whose saved files can't be probed by one another:
+    // slot layout, probe sequence, home and fragment choice, and the hash
+    // of a value-initialized key
+    std::uint64_t layout_signature() const {
+        std::uint64_t res = 0xcbf29ce484222325ull;
+        auto add = [&](std::uint64_t x) {
+            res = (res ^ x) * 0x100000001b3ull;
+        };
+        add(sizeof(slot_type));
+        add(alignof(slot_type));
+        add(sizeof(size_type));
+        add(robin_hood_);
+        add(cached_hash_);
+        add(group_width_);
+        if constexpr (!robin_hood_) {
+            auto it = CollisionPolicy(1024, 3 * group_width_);
+            for (int i = 0; i < 4; ++i, ++it) {
+                add(*it);
+            }
+        }
+        constexpr std::uint64_t sample = 0x9e3779b97f4a7c15ull;
+        add(IndexPolicy::home(static_cast<size_type>(sample), 1024));
+        add(static_cast<std::uint64_t>(IndexPolicy::fragment(static_cast<size_type>(sample))));
+        if constexpr (std::is_default_constructible_v<key_type>) {
+            add(hash_of(key_type{}));
+        }
+        return res;
+    }
+
+    template<class K>
+    size_type hash_of(const K &key) const {
+        if constexpr (is_avalanching_v<hasher> || IndexPolicy::self_mixing) {
+            return hash_(key);
+        } else {
+            return mix_hash(hash_(key));
+        }
+    }
 
-        Element(const Element &element) : type(element.type) {
-            if (element.ptr != nullptr) {
-                ptr = std::make_unique<Type>(element.data());
+    // hash of the element in `slot`, without calling the hasher if the slot keeps it
+    size_type stored_hash(const slot_type &slot) const {
+        if constexpr (cached_hash_) {
+            return slot.hash();
+        } else {
+            return hash_of(key_of_(*slot.get()));
+        }
+    }
+
+    // element in slot `id` has `key`, whose hash is `hash`; cached hashes
+    // are compared first, so key_equal only runs on (near) certain matches
+    template<class K>
+    bool holds(size_type id, const K &key, size_type hash) const {
+        return holds(slots_[id], key, hash);
+    }
+
+    template<class K>
+    bool holds(const slot_type &slot, const K &key, size_type hash) const {
+        if constexpr (cached_hash_) {
+            if (slot.hash() != hash) {
+                return false;
+            }
+        }
+        return equal_(key_of_(*slot.get()), key);
+    }
+
+    size_type home_of(size_type hash) const {
+        return IndexPolicy::home(hash, home_count());
+    }
+
+    // starts loading the home control byte and slot of `hash`
+    void prefetch_home(size_type hash) const {
+        if (home_count() != 0) {
+            size_type home = home_of(hash);
+            prefetch(ctrl_.data() + home);
+            prefetch(slots_.data() + home);
+        }
+    }
+
+    template<class K>
+    size_type prefetched_hash(const K &key) const {
+        size_type hash = hash_of(key);
+        prefetch_home(hash);
+        return hash;
+    }
+
+    // for every batch of up to `batch_size_` elements: `hash` all of them
+    // first, then `apply(element, its hash)` to each one in order
+    template<class It, class HashFn, class Apply>
+    static void for_each_batch(It first, It last, HashFn &&hash, Apply &&apply) {
+        size_type hashes[batch_size_];
+        while (first != last) {
+            It batch = first;
+            size_type n = 0;
+            for (; n < batch_size_ && first != last; ++n, ++first) {
+                hashes[n] = hash(*first);
+            }
+            for (size_type i = 0; i < n; ++i, ++batch) {
+                apply(*batch, hashes[i]);
+            }
+        }
+    }
+
+    // runs `task(0)` .. `task(threads - 1)`, each on its own thread (the
+    // calling one included); rethrows the first exception once all are done
+    template<class Task>
+    static void run_parallel(size_type threads, Task &&task) {
+        std::vector<std::exception_ptr> errors(threads);
+        auto guarded = [&](size_type t) {
+            try {
+                task(t);
+            } catch (...) {
+                errors[t] = std::current_exception();
             }
         };
+        {
+            std::vector<std::jthread> workers;
+            workers.reserve(threads - 1);
+            for (size_type t = 1; t < threads; ++t) {
+                workers.emplace_back(guarded, t);
+            }
+            guarded(0);
+        }
+        for (auto &error: errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+    }
 
-        Element(Element &&element) noexcept {
-            swap(std::move(element));
+    // threads worth starting for `work` slots or elements
+    static size_type thread_count(size_type threads, size_type work) {
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
         }
+        return std::clamp<size_type>(work / parallel_grain_, 1, threads);
+    }
 
-        Element &operator=(const Element &other) {
-            Element tmp(other);
-            swap(tmp);
-            return *this;
+    template<class Self, class F>
+    static void parallel_for_each_impl(Self &self, F &f, size_type threads) {
+        using reference = std::conditional_t<std::is_const_v<Self>, const value_type &, value_type &>;
+        size_type count = self.bucket_count();
+        threads = thread_count(threads, count);
+        run_parallel(threads, [&](size_type t) {
+            const ctrl_t *ctrl = self.ctrl_.data();
+            const ctrl_t *end = ctrl + count * (t + 1) / threads;
+            for (const ctrl_t *pos = next_full_ctrl(ctrl + count * t / threads, end); pos != end;
+                 pos = next_full_ctrl(pos + 1, end)) {
+                f(static_cast<reference>(*self.slots_[pos - ctrl].get()));
+            }
+        });
+    }
+
+    // parallel_insert of `n` elements from `first` on a table with room for
+    // all of them: hash in parallel, bucket the input by region with a
+    // counting sort, fill the regions in parallel, then insert the leftovers
+    template<class It>
+    void parallel_build(It first, size_type n, size_type threads) {
+        using index_vector = std::vector<size_type, typename alloc_traits::template rebind_alloc<size_type>>;
+        // an input element and its hash, bucketed by region
+        struct Entry {
+            size_type index;
+            size_type hash;
+        };
+        using entry_vector = std::vector<Entry, typename alloc_traits::template rebind_alloc<Entry>>;
+        // regions small enough for their slots to stay in cache while they
+        // are filled, and many more than threads, so none waits on a slow one
+        size_type regions = home_count() / parallel_grain_;
+        size_type region_bits = std::countr_zero(home_count()) - std::countr_zero(regions);
+        index_vector hashes(n, alloc_);
+        // per input chunk, then per region: where the chunk's elements go in `entries`
+        index_vector offsets(threads * regions, 0, alloc_);
+        run_parallel(threads, [&](size_type t) {
+            size_type *counts = offsets.data() + t * regions;
+            for (size_type i = n * t / threads; i < n * (t + 1) / threads; ++i) {
+                hashes[i] = hash_of(key_of_(first[i]));
+                ++counts[home_of(hashes[i]) >> region_bits];
+            }
+        });
+        // regions' starts in `entries`, plus n at the end
+        index_vector bounds(regions + 1, alloc_);
+        size_type total = 0;
+        for (size_type r = 0; r < regions; ++r) {
+            bounds[r] = total;
+            for (size_type t = 0; t < threads; ++t) {
+                total += std::exchange(offsets[t * regions + r], total);
+            }
         }
+        bounds[regions] = total;
+        // stable: elements of a region stay in input order
+        entry_vector entries(n, alloc_);
+        run_parallel(threads, [&](size_type t) {
+            size_type *next = offsets.data() + t * regions;
+            for (size_type i = n * t / threads; i < n * (t + 1) / threads; ++i) {
+                entries[next[home_of(hashes[i]) >> region_bits]++] = {i, hashes[i]};
+            }
+        });
+        index_vector().swap(hashes);
+        // per region: elements inserted, slots taken that were free, lowest
+        // slot filled and leftovers kept at the start of its part of `entries`
+        index_vector inserted(regions, 0, alloc_), filled(regions, 0, alloc_);
+        index_vector lowest(regions, bucket_count(), alloc_), leftovers(regions, 0, alloc_);
+        index_vector prints(regions, 0, alloc_);
+        // a region whose worker threw is left as it is, the rest are still committed
+        auto commit = [&] {
+            for (size_type r = 0; r < regions; ++r) {
+                size_ += inserted[r];
+                cells_cnt_ += filled[r];
+                fingerprint_ += prints[r];
+                first_full_ = std::min(first_full_, lowest[r]);
+            }
+        };
+        std::atomic<size_type> next_region = 0;
+        try {
+            run_parallel(threads, [&](size_type) {
+                for (size_type r; (r = next_region.fetch_add(1, std::memory_order_relaxed)) < regions;) {
+                    size_type lo = r << region_bits, hi = (r + 1) << region_bits;
+                    for (size_type k = bounds[r]; k < bounds[r + 1]; ++k) {
+                        // the input is read out of order here, its misses overlap
+                        if constexpr (std::is_lvalue_reference_v<std::iter_reference_t<It>>) {
+                            if (k + batch_size_ < bounds[r + 1]) {
+                                prefetch(std::addressof(first[entries[k + batch_size_].index]));
+                            }
+                        }
+                        auto [i, hash] = entries[k];
+                        bool present = false;
+                        size_type id = region_slot(key_of_(first[i]), hash, lo, hi, present);
+                        if (id == npos) {
+                            entries[bounds[r] + leftovers[r]++] = entries[k];
+                        } else if (!present) {
+                            slots_[id].construct(alloc_, first[i]);
+                            filled[r] += ctrl_[id] == CTRL_FREE;
+                            if constexpr (cached_hash_) {
+                                slots_[id].set_hash(hash);
+                            }
+                            ctrl_[id] = IndexPolicy::fragment(hash);
+                            ++inserted[r];
+                            prints[r] += print_of(hash);
+                            lowest[r] = std::min(lowest[r], id);
+                        }
+                    }
+                }
+            });
+        } catch (...) {
+            commit();
+            throw;
+        }
+        commit();
+        for (size_type r = 0; r < regions; ++r) {
+            for (size_type k = bounds[r]; k < bounds[r] + leftovers[r]; ++k) {
+                auto [i, hash] = entries[k];
+                insert_with(key_of_(first[i]), hash, [&](slot_type &slot) {
+                    slot.construct(alloc_, first[i]);
+                });
+            }
+        }
+    }
 
-        Element &operator=(Element &&other) noexcept {
-            swap(std::move(other));
-            return *this;
+    // find_or_prepare_insert confined to home slots [lo, hi): the slot of
+    // `key` (`present` is set) or the one to insert it into, or npos as soon
+    // as the probe would leave the region; reads and writes nothing outside it
+    template<class K>
+    size_type region_slot(const K &key, size_type hash, size_type lo, size_type hi, bool &present) const {
+        size_type id = npos;
+        ctrl_t h2 = IndexPolicy::fragment(hash);
+        for (auto it = CollisionPolicy(home_count(), home_of(hash));; ++it) {
+            if (*it < lo || *it >= hi) {
+                return npos;
+            }
+            if constexpr (group_width_ > 1) {
+                Group group(ctrl_.data() + *it);
+                for (size_type i: group.match(h2)) {
+                    if (holds(*it + i, key, hash)) {
+                        present = true;
+                        return *it + i;
+                    }
+                }
+                auto mask = group.match_free_or_deleted();
+                if (id == npos && mask) {
+                    id = *it + mask.lowest();
+                }
+                if (group.match_free()) {
+                    return id;
+                }
+            } else {
+                ctrl_t ctrl = ctrl_[*it];
+                if (ctrl == h2 && holds(*it, key, hash)) {
+                    present = true;
+                    return *it;
+                }
+                if (id == npos && !is_full(ctrl)) {
+                    id = *it;
+                }
+                if (ctrl == CTRL_FREE) {
+                    return id;
+                }
+            }
         }
+    }
 
-        void swap(Element &&element) noexcept {
-            std::swap(element.type, type);
-            std::swap(element.ptr, ptr);
+    // robin hood tables never wrap around: elements displaced past the last
+    // home slot go to an overflow area at the end of the arrays; this is its
+    // least size, rehash_to makes it larger where the last run needs it
+    static size_type overflow_for(size_type count) {
+        if constexpr (robin_hood_) {
+            return count == 0 ? 0 : std::min<size_type>(count - 1, max_distance_);
+        } else {
+            return 0;
         }
+    }
+
+    // robin hood: control byte of an element `dist` slots away from its home
+    static ctrl_t distance_byte(size_type dist) {
+        return static_cast<ctrl_t>(std::min<size_type>(dist, max_distance_));
+    }
 
-        const Type &data() const {
-            return *ptr;
+    // robin hood: probe distance of the element in slot `id` of arrays laid
+    // out like this table's with `homes` home slots
+    size_type distance_in(const ctrl_t *ctrl, const slot_type *slots, size_type homes, size_type id) const {
+        if (ctrl[id] < max_distance_) {
+            return ctrl[id];
         }
+        return id - IndexPolicy::home(stored_hash(slots[id]), homes);
+    }
+
+    size_type distance_at(size_type id) const {
+        return distance_in(ctrl_.data(), slots_.data(), home_count(), id);
+    }
 
-        Type &data() {
-            return *ptr;
+    // robin hood: probes from the home of `hash` for an element `match(id)`
+    // holds for and returns its slot; otherwise returns npos and leaves
+    // `pos` at the first slot holding an element closer to its home than
+    // one of `hash` would be there, or a free one
+    template<class Match>
+    size_type robin_hood_probe(const ctrl_t *ctrl, const slot_type *slots, size_type buckets, size_type hash,
+                               size_type &pos, Match &&match) const {
+        size_type homes = home_count_for(buckets);
+        pos = IndexPolicy::home(hash, homes);
+        size_type dist = 0;
+        // elements are sorted by probe distance, so meeting one closer to
+        // its home than we are to ours means the key is absent
+        for (; dist < max_distance_ && pos < buckets && ctrl[pos] >= static_cast<ctrl_t>(dist); ++pos, ++dist) {
+            if (ctrl[pos] == static_cast<ctrl_t>(dist) && match(pos)) {
+                return pos;
+            }
         }
+        if (dist < max_distance_) {
+            return npos;
+        }
+        // only elements at saturated bytes are as far from home as we are
+        for (; pos < buckets && ctrl[pos] == max_distance_; ++pos, ++dist) {
+            size_type other = distance_in(ctrl, slots, homes, pos);
+            if (other < dist) {
+                break;
+            }
+            if (other == dist && match(pos)) {
+                return pos;
+            }
+        }
+        return npos;
+    }
 
-        template<class... Args>
-        void set(Args &&... args) {
-            type = DATA;
-            ptr = std::make_unique<Type>(std::forward<Args>(args)...);
+    // number of slots an element's home can fall into
+    size_type home_count() const {
+        return home_count_for(bucket_count());
+    }
+
+    static size_type home_count_for(size_type buckets) {
+        if constexpr (robin_hood_) {
+            return buckets == 0 ? 0 : std::bit_floor(buckets);
+        } else {
+            return buckets;
         }
+    }
+
+    iterator iterator_at(size_type id) {
+        return iterator(ctrl_.data() + id, ctrl_.data() + bucket_count(), slots_.data() + id);
+    }
+
+    const_iterator iterator_at(size_type id) const {
+        return const_iterator(ctrl_.data() + id, ctrl_.data() + bucket_count(), slots_.data() + id);
+    }
 
+    static const ctrl_t *ctrl_of(const_iterator it) {
+        return it.ctrl_;
+    }
 
-        void free() {
-            type = DELETED;
-            ptr.reset(nullptr);
+    iterator mutable_iterator(const_iterator it) {
+        return iterator_at(it.ctrl_ - ctrl_.data());
+    }
+
+    size_type index_or_end(size_type id) const {
+        return id == npos ? bucket_count() : id;
+    }
+
+    size_type next_full(size_type id) const {
+        return next_full_ctrl(ctrl_.data() + id, ctrl_.data() + bucket_count()) - ctrl_.data();
+    }
+
+    // slot holding `key` or npos
+    template<class K>
+    size_type find_index(const K &key, size_type hash) const {
+        if (size_ == 0) {
+            return npos;
         }
-    };
+        return find_in(ctrl_.data(), slots_.data(), bucket_count(), key, hash);
+    }
+
+    // find_index over `buckets` slots laid out like this table's, which need
+    // not be its own: MappedHashTable probes the arrays of a mapped file
+    template<class K>
+    size_type find_in(const ctrl_t *ctrl, const slot_type *slots, size_type buckets, const K &key,
+                      size_type hash) const {
+        size_type homes = home_count_for(buckets);
+        if constexpr (robin_hood_) {
+            size_type pos;
+            return robin_hood_probe(ctrl, slots, buckets, hash, pos, [&](size_type id) {
+                return holds(slots[id], key, hash);
+            });
+        } else if constexpr (group_width_ > 1) {
+            ctrl_t h2 = IndexPolicy::fragment(hash);
+            for (auto it = CollisionPolicy(homes, IndexPolicy::home(hash, homes));; ++it) {
+                Group group(ctrl + *it);
+                for (size_type i: group.match(h2)) {
+                    if (holds(slots[*it + i], key, hash)) {
+                        return *it + i;
+                    }
+                }
+                if (group.match_free()) {
+                    return npos;
+                }
+            }
+        } else {
+            ctrl_t h2 = IndexPolicy::fragment(hash);
+            for (auto it = CollisionPolicy(homes, IndexPolicy::home(hash, homes)); ctrl[*it] != CTRL_FREE; ++it) {
+                if (ctrl[*it] == h2 && holds(slots[*it], key, hash)) {
+                    return *it;
+                }
+            }
+            return npos;
+        }
+    }
+
+    // probes once for `key`: returns {its slot, false} if it is present,
+    // otherwise {a free slot prepared for it, true}, growing the table first
+    // if the new element would not fit
+    template<class K>
+    std::pair<size_type, bool> find_or_prepare_insert(const K &key, size_type hash) {
+        size_type id = npos;
+        bool fits = cells_cnt_ + 1 <= max_load_factor() * home_count();
+        if (home_count() == 0) {
+            // moved-from table without slots
+        } else if constexpr (robin_hood_) {
+            size_type pos;
+            size_type found = robin_hood_probe(ctrl_.data(), slots_.data(), bucket_count(), hash, pos,
+                                               [&](size_type i) { return holds(i, key, hash); });
+            if (found != npos) {
+                return {found, false};
+            }
+            if (fits) {
+                id = make_room(pos);
+            }
+        } else if constexpr (group_width_ > 1) {
+            ctrl_t h2 = IndexPolicy::fragment(hash);
+            for (auto it = CollisionPolicy(home_count(), home_of(hash));; ++it) {
+                Group group(ctrl_.data() + *it);
+                for (size_type i: group.match(h2)) {
+                    if (holds(*it + i, key, hash)) {
+                        return {*it + i, false};
+                    }
+                }
+                auto mask = group.match_free_or_deleted();
+                if (id == npos && mask) {
+                    id = *it + mask.lowest();
+                }
+                if (group.match_free()) {
+                    break;
+                }
+            }
+        } else {
+            ctrl_t h2 = IndexPolicy::fragment(hash);
+            for (auto it = CollisionPolicy(home_count(), home_of(hash));; ++it) {
+                ctrl_t ctrl = ctrl_[*it];
+                if (ctrl == h2 && holds(*it, key, hash)) {
+                    return {*it, false};
+                }
+                if (id == npos && !is_full(ctrl)) {
+                    id = *it;
+                }
+                if (ctrl == CTRL_FREE) {
+                    break;
+                }
+            }
+        }
+        if constexpr (!robin_hood_) {
+            // reusing a tombstone never needs more room
+            if (id != npos && ctrl_[id] == CTRL_FREE && !fits) {
+                id = npos;
+            }
+        }
+        if (id == npos) {
+            grow();
+            id = prepare_insert_or_grow(hash);
+        }
+        return {id, true};
+    }
+
+    // probes once for `key`; if it is absent, `fill` constructs the element
+    // in the slot prepared for it; returns the slot and whether it was filled
+    template<class K, class Fill>
+    std::pair<size_type, bool> insert_with(const K &key, size_type hash, Fill &&fill) {
+        auto [id, inserted] = find_or_prepare_insert(key, hash);
+        if (inserted) {
+            try {
+                fill(slots_[id]);
+            } catch (...) {
+                abandon_slot(id);
+                throw;
+            }
+            occupy(id, hash);
+        }
+        return {id, inserted};
+    }
+
+    // moves the element in slot `id` into `dst`, which must not contain its key
+    void transfer(size_type id, HashTable &dst) {
+        size_type hash = stored_hash(slots_[id]);
+        if (dst.cells_cnt_ + 1 > dst.max_load_factor() * dst.home_count()) {
+            dst.grow();
+        }
+        size_type dst_id = dst.prepare_insert_or_grow(hash);
+        try {
+            dst.adopt_slot(*this, id, dst.slots_[dst_id]);
+        } catch (...) {
+            dst.abandon_slot(dst_id);
+            throw;
+        }
+        dst.occupy(dst_id, hash);
+        remove_at(id, hash);
+    }
 
-    static size_type optimal_size(size_type sz) {
-        size_type k = 1ull << (sizeof(size_type) * 8 - 1);
-        while ((sz & k) == 0) {
-            k >>= 1u;
+    // moves the element in `src`'s slot `id` into the empty slot `to` of
+    // this table; nodes change hands between tables of equal allocators
+    // unless they belong to a pool, otherwise the element is moved
+    void adopt_slot(HashTable &src, size_type id, slot_type &to) {
+        if constexpr (!table_owned_nodes_) {
+            if (alloc_ == src.alloc_) {
+                to.relocate(alloc_, src.slots_[id]);
+                return;
+            }
         }
-        return k << 1u;
+        to.construct(alloc_, std::move(*src.slots_[id].get()));
+        src.slots_[id].destroy(src.alloc_);
     }
 
-    void check_size() {
-        if (cells_cnt_ > max_load_factor() * bucket_count()) {
-            rehash(bucket_count() / max_load_factor());
+    // moves the element of `slot` into a new node, leaving the slot empty
+    // but still counted as full
+    node_type release_cell(slot_type &slot) {
+        node_type node;
+        value_allocator alloc(get_allocator());
+        if constexpr (table_owned_nodes_) {
+            // nodes can't leave their pool
+            node.cell_.construct(alloc, std::move(*slot.get()));
+            if constexpr (cached_hash_) {
+                node.cell_.set_hash(slot.hash());
+            }
+            slot.destroy(alloc_);
+        } else {
+            node.cell_.relocate(alloc_, slot);
         }
+        node.alloc_.emplace(std::move(alloc));
+        return node;
     }
 
-    void insert(Element &element) {
-        check_size();
-        size_type hash = hash_(key_from_value_(element.data())) % data_.size();
-        auto it = CollisionPolicy(data_.size(), hash);
-        for (; data_[*it].type != FREE; ++it) {
-            if (data_[*it].type == DATA && equal_(key_from_value_(data_[*it].data()), key_from_value_(element.data()))) {
+    // the same for the element of `node`, which is left empty
+    void adopt_node(node_type &node, slot_type &to) {
+        if constexpr (!table_owned_nodes_) {
+            if (alloc_ == *node.alloc_) {
+                to.relocate(alloc_, node.cell_);
+                node.alloc_.reset();
                 return;
             }
         }
-        data_[*it] = std::move(element);
+        to.construct(alloc_, std::move(node.value()));
+        node.reset();
+    }
+
+    // moves the element at `pos` of `src` into this table unless its key is
+    // here already; returns where the key is and whether it moved
+    std::pair<iterator, bool> take(HashTable &src, const_iterator pos) {
+        size_type id = pos.ctrl_ - src.ctrl_.data();
+        const slot_type &slot = src.slots_[id];
+        size_type hash = foreign_hash(slot);
+        size_type src_hash = std::is_empty_v<hasher> ? hash : src.stored_hash(slot);
+        auto [dst_id, inserted] = insert_with(key_of_(*slot.get()), hash, [&](slot_type &to) {
+            adopt_slot(src, id, to);
+        });
+        if (inserted) {
+            src.remove_at(id, src_hash);
+        }
+        return {iterator_at(dst_id), inserted};
+    }
+
+    std::pair<size_type, bool> insert_node(node_type &node, size_type hash) {
+        return insert_with(key_of_(node.value()), hash, [&](slot_type &to) {
+            adopt_node(node, to);
+        });
+    }
+
+    template<class K>
+    node_type extract_key(const K &key) {
+        size_type id = find_index(key, hash_of(key));
+        return id == npos ? node_type() : extract(iterator_at(id));
+    }
+
+    // hash of the element in a slot of another table of this type, or of a
+    // node; a cached one is reused when hashers can't disagree, being empty
+    size_type foreign_hash(const slot_type &slot) const {
+        if constexpr (cached_hash_ && std::is_empty_v<hasher>) {
+            return slot.hash();
+        } else {
+            return hash_of(key_of_(*slot.get()));
+        }
+    }
+
+    size_type node_hash(const node_type &node) const {
+        return foreign_hash(node.cell_);
+    }
+
+    const auto &key_of(const value_type &value) const {
+        return key_of_(value);
+    }
+
+    // `a` and `b` have equal keys already
+    static bool same_value(const value_type &a, const value_type &b) {
+        if constexpr (std::is_same_v<key_type, value_type>) {
+            return true;
+        } else if constexpr (requires { a.second == b.second; }) {
+            return a.second == b.second;
+        } else {
+            return a == b;
+        }
+    }
+
+    // empty table with the functors, allocator and load factor of `o`,
+    // with room for `count` elements
+    static HashTable empty_like(const HashTable &o, size_type count, const allocator_type &alloc) {
+        HashTable res(no_slots_t(), o.hash_, o.equal_, o.key_of_, alloc);
+        res.max_load_factor_ = o.max_load_factor_;
+        res.allocate(res.capacity_for(count));
+        return res;
+    }
+
+    // copy of `o` with room for `count` elements; if `o` has too few slots,
+    // its elements are copied straight into the larger arrays, found a slot
+    // by their stored hash and never compared, rather than rehashed after
+    static HashTable copy_like(const HashTable &o, size_type count, const allocator_type &alloc) {
+        if (o.capacity_for(count) <= o.home_count()) {
+            return HashTable(o, alloc);
+        }
+        HashTable res = empty_like(o, count, alloc);
+        for (size_type i = o.next_full(o.first_full_); i < o.bucket_count(); i = o.next_full(i + 1)) {
+            size_type hash = o.stored_hash(o.slots_[i]);
+            size_type id = res.prepare_insert_or_grow(hash);
+            try {
+                res.slots_[id].construct(res.alloc_, *o.slots_[i].get());
+            } catch (...) {
+                res.abandon_slot(id);
+                throw;
+            }
+            res.occupy(id, hash);
+        }
+        return res;
+    }
+
+    // free slot for a new element with `hash`: the first FREE or DELETED slot
+    // on its probe sequence; robin hood tables shift richer elements forward
+    // to make room and return npos if that would run past the overflow area
+    size_type prepare_insert(size_type hash) {
+        if constexpr (robin_hood_) {
+            size_type pos;
+            robin_hood_probe(ctrl_.data(), slots_.data(), bucket_count(), hash, pos, [](size_type) { return false; });
+            return make_room(pos);
+        } else if constexpr (group_width_ > 1) {
+            for (auto it = CollisionPolicy(home_count(), home_of(hash));; ++it) {
+                auto mask = Group(ctrl_.data() + *it).match_free_or_deleted();
+                if (mask) {
+                    return *it + mask.lowest();
+                }
+            }
+        } else {
+            auto it = CollisionPolicy(home_count(), home_of(hash));
+            for (; is_full(ctrl_[*it]); ++it) {}
+            return *it;
+        }
+    }
+
+    // robin hood: frees slot `pos` by shifting the rest of its run one slot
+    // forward; npos if the run already ends the arrays
+    size_type make_room(size_type pos) {
+        size_type last = pos;
+        for (; last < bucket_count() && is_full(ctrl_[last]); ++last) {}
+        if (last == bucket_count()) {
+            return npos;
+        }
+        for (; last != pos; --last) {
+            slots_[last].relocate(alloc_, slots_[last - 1]);
+            ctrl_[last] = distance_byte(size_type(ctrl_[last - 1]) + 1);
+            // a throwing move must not leave an emptied slot marked full
+            ctrl_[last - 1] = CTRL_FREE;
+        }
+        return pos;
+    }
+
+    // backward shift: pulls the displaced elements following the free slot
+    // `id` one slot closer to their home
+    void close_gap(size_type id) {
+        for (; id + 1 < bucket_count() && ctrl_[id + 1] > 0; ++id) {
+            ctrl_t next = ctrl_[id + 1] < max_distance_ ? static_cast<ctrl_t>(ctrl_[id + 1] - 1)
+                                                        : distance_byte(distance_at(id + 1) - 1);
+            slots_[id].relocate(alloc_, slots_[id + 1]);
+            ctrl_[id] = next;
+        }
+        ctrl_[id] = CTRL_FREE;
+    }
+
+    // undoes find_or_prepare_insert when constructing the element failed
+    void abandon_slot(size_type id) {
+        if constexpr (robin_hood_) {
+            close_gap(id);
+        }
+    }
+
+    // number of probes a lookup of the element in slot `id` takes
+    size_type probe_length(size_type id) const {
+        if constexpr (robin_hood_) {
+            return distance_at(id) + 1;
+        } else {
+            size_type target = id / group_width_ * group_width_;
+            size_type len = 1;
+            for (auto it = CollisionPolicy(home_count(), home_of(stored_hash(slots_[id])));
+                 *it != target; ++it) {
+                ++len;
+            }
+            return len;
+        }
+    }
+
+    template<class K>
+    size_type erase_key(const K &key) {
+        size_type hash = hash_of(key);
+        size_type id = find_index(key, hash);
+        if (id == npos) {
+            return 0;
+        }
+        erase_at(id, hash);
+        return 1;
+    }
+
+    void occupy(size_type id, size_type hash) {
+        if (ctrl_[id] == CTRL_FREE) {
+            ++cells_cnt_;
+        }
+        if constexpr (cached_hash_) {
+            slots_[id].set_hash(hash);
+        }
+        if constexpr (robin_hood_) {
+            ctrl_[id] = distance_byte(id - home_of(hash));
+        } else {
+            ctrl_[id] = IndexPolicy::fragment(hash);
+        }
         ++size_;
-        ++cells_cnt_;
+        fingerprint_ += print_of(hash);
+        first_full_ = std::min(first_full_, id);
+    }
+
+    // share of an element with `hash` in fingerprint_; hash_of mixes
+    // everything but what a self mixing index policy is given raw
+    static size_type print_of(size_type hash) {
+        if constexpr (is_avalanching_v<hasher> || !IndexPolicy::self_mixing) {
+            return hash;
+        } else {
+            return mix_hash(hash);
+        }
+    }
+
+    // finds a slot for `hash`; robin hood tables whose last run reaches the
+    // end of the arrays are rebuilt with twice the overflow area first
+    size_type prepare_insert_or_grow(size_type hash) {
+        size_type id;
+        while ((id = prepare_insert(hash)) == npos) {
+            size_type overflow = bucket_count() - home_count();
+            if (overflow + 1 < home_count()) {
+                rehash_to(home_count(), std::min(home_count() - 1, 2 * overflow + 1));
+            } else {
+                rehash_to(home_count() * 2);
+            }
+        }
+        return id;
+    }
+
+    void erase_at(size_type id) {
+        erase_at(id, stored_hash(slots_[id]));
+    }
+
+    // `hash` is that of the element in slot `id`
+    void erase_at(size_type id, size_type hash) {
+        slots_[id].destroy(alloc_);
+        remove_at(id, hash);
+    }
+
+    // marks slot `id`, whose element (of `hash`) is already destroyed or
+    // moved out, as unused
+    void remove_at(size_type id, size_type hash) {
+        fingerprint_ -= print_of(hash);
+        clear_slot(id);
+        // robin hood may have shifted the next element into `id`
+        if (id == first_full_) {
+            first_full_ = next_full(id);
+        }
+    }
+
+    // linear probing only: a tombstone followed by a free slot ends every
+    // probe that reaches it anyway, so it can be freed too; walks backwards
+    // once around the table from a free slot, freeing whole tails of runs
+    void free_run_tombstones() {
+        ctrl_t *ctrl = ctrl_.data();
+        size_type count = bucket_count();
+        size_type free = std::find(ctrl, ctrl + count, CTRL_FREE) - ctrl;
+        // whether the slot after the current one is free; runs are random,
+        // so this is kept free of branches
+        bool before_free = true;
+        size_type freed = 0;
+        auto visit = [&](size_type id) {
+            ctrl_t c = ctrl[id];
+            bool drop = before_free & (c == CTRL_DELETED);
+            ctrl[id] = drop ? ctrl_t(CTRL_FREE) : c;
+            freed += drop;
+            before_free = drop | (c == CTRL_FREE);
+        };
+        for (size_type id = free; id-- > 0;) {
+            visit(id);
+        }
+        for (size_type id = count; id-- > free + 1;) {
+            visit(id);
+        }
+        cells_cnt_ -= freed;
+    }
+
+    void clear_slot(size_type id) {
+        --size_;
+        // robin hood tables shift the following elements back, so no tombstone is left
+        if constexpr (robin_hood_) {
+            close_gap(id);
+            --cells_cnt_;
+            return;
+        }
+        // a group that still has a FREE slot ends every probe sequence passing
+        // through it, so the slot can be freed instead of left as a tombstone
+        if constexpr (group_width_ > 1) {
+            if (Group(ctrl_.data() + id / group_width_ * group_width_).match_free()) {
+                ctrl_[id] = CTRL_FREE;
+                --cells_cnt_;
+                return;
+            }
+        }
+        ctrl_[id] = CTRL_DELETED;
+    }
+
+    // fresh arrays with `count` homes and at least `overflow` slots past them
+    void allocate(size_type count, size_type overflow = 0) {
+        overflow = std::max(overflow, overflow_for(count));
+        ctrl_.assign(count + overflow, CTRL_FREE);
+        slots_ = slot_vector(count + overflow, slots_.get_allocator());
+        size_ = 0;
+        cells_cnt_ = 0;
+        fingerprint_ = 0;
+        first_full_ = bucket_count();
+    }
+
+    // like allocate(), with arrays sized and cleared elsewhere: exchanged
+    // for the (empty) ones of this table
+    void allocate_from(ctrl_vector &ctrl, slot_vector &slots) noexcept {
+        ctrl_.swap(ctrl);
+        slots_.swap(slots);
+        size_ = 0;
+        cells_cnt_ = 0;
+        fingerprint_ = 0;
+        first_full_ = bucket_count();
+    }
+
+    void destroy_all() noexcept {
+        if constexpr (!slot_type::trivial_destroy) {
+            for (size_type i = 0; i < ctrl_.size(); ++i) {
+                if (is_full(ctrl_[i])) {
+                    slots_[i].destroy(alloc_);
+                }
+            }
+        }
+        std::fill(ctrl_.begin(), ctrl_.end(), CTRL_FREE);
+        size_ = 0;
+        cells_cnt_ = 0;
+        fingerprint_ = 0;
+        first_full_ = bucket_count();
+    }
+
+    // leaves the table without slots, like a moved-from one, but with its
+    // functors and allocator
+    void release_slots() noexcept {
+        destroy_all();
+        ctrl_vector(ctrl_.get_allocator()).swap(ctrl_);
+        slot_vector(slots_.get_allocator()).swap(slots_);
+        first_full_ = 0;
+    }
+
+    static size_type capacity_for_buckets(size_type count) {
+        return std::max(min_bucket_count_, std::bit_ceil(std::max<size_type>(count, 1)));
+    }
+
+    // smallest table holding `expected_max_size` elements without growing
+    size_type capacity_for(size_type expected_max_size) const {
+        return capacity_for_buckets(static_cast<size_type>(std::ceil(expected_max_size / max_load_factor_)));
+    }
+
+    // makes room for one more element: rebuilds in place if the table is
+    // mostly tombstones, otherwise doubles it
+    void grow() {
+        if (size_ + 1 > max_load_factor() * home_count() / 2) {
+            rehash_to(capacity_for_buckets(home_count() * 2));
+        } else {
+            drop_tombstones();
+        }
+    }
+
+    // same size rehash without allocating: elements are moved straight to
+    // their new slots in one pass, only tables of nothrow relocatable
+    // elements with nothrow hashing, others are rebuilt into new arrays
+    void drop_tombstones() {
+        constexpr bool in_place = !robin_hood_ && nothrow_relocate_ && nothrow_stored_hash_;
+        if constexpr (!in_place) {
+            rehash_to(capacity_for_buckets(home_count()));
+        } else {
+            RehashScope scope(stats_);
+            // DELETED now marks elements not placed yet, FREE everything else
+            for (auto &ctrl: ctrl_) {
+                ctrl = is_full(ctrl) ? CTRL_DELETED : CTRL_FREE;
+            }
+            for (size_type i = 0; i < bucket_count(); ++i) {
+                while (ctrl_[i] == CTRL_DELETED) {
+                    size_type hash = stored_hash(slots_[i]);
+                    size_type id = prepare_insert(hash);
+                    if (id / group_width_ == i / group_width_) {
+                        // already in the first slot (group) its lookup can reach
+                        ctrl_[i] = IndexPolicy::fragment(hash);
+                    } else if (ctrl_[id] == CTRL_FREE) {
+                        slots_[id].relocate(alloc_, slots_[i]);
+                        ctrl_[id] = IndexPolicy::fragment(hash);
+                        ctrl_[i] = CTRL_FREE;
+                    } else {
+                        // another unplaced element is in the way: swap them
+                        // and place the one brought into `i` next
+                        slot_type tmp;
+                        tmp.relocate(alloc_, slots_[id]);
+                        slots_[id].relocate(alloc_, slots_[i]);
+                        slots_[i].relocate(alloc_, tmp);
+                        ctrl_[id] = IndexPolicy::fragment(hash);
+                    }
+                }
+            }
+            cells_cnt_ = size_;
+            first_full_ = next_full(0);
+        }
+    }
+
+    // reports a rehash to the statistics policy, also when it throws
+    class RehashScope {
+    private:
+        StatsPolicy &stats_;
+    public:
+        explicit RehashScope(StatsPolicy &stats) : stats_(stats) {
+            stats_.rehash_started();
+        }
+
+        RehashScope(const RehashScope &) = delete;
+
+        RehashScope &operator=(const RehashScope &) = delete;
+
+        ~RehashScope() {
+            stats_.rehash_finished();
+        }
+    };
+
+    // robin hood: overflow area the last run of this table's elements fits
+    // in once they have `count` homes. Homes are counted per block of slots,
+    // as if every element's home began its block, which overestimates the
+    // end of the last run by less than a block
+    size_type overflow_needed(size_type count, const size_type *hashes) const {
+        using index_vector = std::vector<size_type, typename alloc_traits::template rebind_alloc<size_type>>;
+        constexpr size_type block = max_distance_ + 1;
+        index_vector blocks((count + block - 1) / block, 0, get_allocator());
+        size_type k = 0;
+        for (size_type i = next_full(first_full_); i < bucket_count(); i = next_full(i + 1)) {
+            size_type hash = hashes != nullptr ? hashes[k++] : stored_hash(slots_[i]);
+            ++blocks[IndexPolicy::home(hash, count) / block];
+        }
+        size_type end = 0;
+        for (size_type b = 0; b < blocks.size(); ++b) {
+            end = std::max(end, b * block) + blocks[b];
+        }
+        return std::min(count - 1, end + block > count ? end + block - count : 0);
+    }
+
+    // rebuilds the table with `count` homes and at least `overflow` slots
+    // past them; the old arrays are only let go of once every element is in
+    // the new ones. Hashes that may throw are all taken first, elements whose
+    // move may throw are copied, so a throw leaves the table as it was; only
+    // move-only elements with a throwing move lose those not moved yet
+    void rehash_to(size_type count, size_type overflow = 0) {
+        using index_vector = std::vector<size_type, typename alloc_traits::template rebind_alloc<size_type>>;
+        constexpr bool copy = !nothrow_relocate_ && std::is_copy_constructible_v<value_type>;
+        RehashScope scope(stats_);
+        index_vector hashes(get_allocator());
+        if constexpr (!nothrow_stored_hash_) {
+            hashes.reserve(size_);
+            for (size_type i = next_full(first_full_); i < bucket_count(); i = next_full(i + 1)) {
+                hashes.push_back(stored_hash(slots_[i]));
+            }
+        }
+        if constexpr (robin_hood_) {
+            overflow = std::max(overflow, overflow_needed(count, hashes.empty() ? nullptr : hashes.data()));
+        }
+        overflow = std::max(overflow, overflow_for(count));
+        ctrl_vector old_ctrl(count + overflow, CTRL_FREE, ctrl_.get_allocator());
+        slot_vector old_slots(count + overflow, slots_.get_allocator());
+        std::swap(old_ctrl, ctrl_);
+        std::swap(old_slots, slots_);
+        size_type old_size = size_;
+        size_type old_cells = cells_cnt_;
+        size_type old_fingerprint = fingerprint_;
+        size_type old_first = first_full_;
+        size_ = 0;
+        cells_cnt_ = 0;
+        fingerprint_ = 0;
+        first_full_ = bucket_count();
+        size_type i = 0, k = 0;
+        try {
+            for (; i < old_ctrl.size(); ++i) {
+                if (is_full(old_ctrl[i])) {
+                    size_type hash = hashes.empty() ? stored_hash(old_slots[i]) : hashes[k++];
+                    // the overflow area fits every run, so this finds a slot
+                    size_type id = prepare_insert(hash);
+                    try {
+                        if constexpr (copy) {
+                            slots_[id].construct(alloc_, std::as_const(*old_slots[i].get()));
+                        } else {
+                            slots_[id].relocate(alloc_, old_slots[i]);
+                        }
+                    } catch (...) {
+                        abandon_slot(id);
+                        throw;
+                    }
+                    occupy(id, hash);
+                }
+            }
+        } catch (...) {
+            if constexpr (copy) {
+                destroy_all();
+                std::swap(old_ctrl, ctrl_);
+                std::swap(old_slots, slots_);
+                size_ = old_size;
+                cells_cnt_ = old_cells;
+                fingerprint_ = old_fingerprint;
+                first_full_ = old_first;
+            } else {
+                for (; i < old_ctrl.size(); ++i) {
+                    if (is_full(old_ctrl[i])) {
+                        old_slots[i].destroy(alloc_);
+                    }
+                }
+            }
+            throw;
+        }
+        if constexpr (copy && !slot_type::trivial_destroy) {
+            for (i = 0; i < old_ctrl.size(); ++i) {
+                if (is_full(old_ctrl[i])) {
+                    old_slots[i].destroy(alloc_);
+                }
+            }
+        }
     }
 
     hasher hash_;
     key_equal equal_;
-    std::vector<Element> data_;
+    [[no_unique_address]] KeyOf key_of_;
+    [[no_unique_address]] element_allocator alloc_;
+    [[no_unique_address]] StatsPolicy stats_;
+    ctrl_vector ctrl_;
+    slot_vector slots_;
     size_type size_ = 0;
     size_type cells_cnt_ = 0;
-    std::function<const key_type &(const_reference)> key_from_value_;
-    constexpr static float max_load_factor_ = 0.5;
-};
\ No newline at end of file
+    // sum of the (mixed) hashes of all elements, see fingerprint()
+    size_type fingerprint_ = 0;
+    // lowest full slot, or bucket_count() if there is none: begin() in O(1)
+    size_type first_full_ = 0;
+    float max_load_factor_ = policy_load_factor<CollisionPolicy>();
+};
+
+// intersect, unite and difference of HashSet and HashMap, for HashTable and
+// IncrementalHashTable alike: the smaller operand is the one iterated, each
+// of its keys looked up in the other; the result has room for its largest
+// possible size from the start, and rvalue operands give their elements up
+// slot to slot (see merge) instead of having them copied. Where both
+// operands hold a key, the result holds the element of the left one; it
+// allocates from the left operand's allocator, but for unite of rvalues,
+// which fills the larger one
+template<class Table>
+struct SetAlgebra {
+    using value_type = typename Table::value_type;
+
+    static Table intersect(const Table &a, const Table &b) {
+        Table res = Table::empty_like(a, std::min(a.size(), b.size()), a.get_allocator());
+        if (a.size() <= b.size()) {
+            for (const value_type &el: a) {
+                if (b.contains(a.key_of(el))) {
+                    res.insert(el);
+                }
+            }
+        } else {
+            for (const value_type &el: b) {
+                auto it = a.find(b.key_of(el));
+                if (it != a.end()) {
+                    res.insert(*it);
+                }
+            }
+        }
+        return res;
+    }
+
+    static Table intersect(Table &&a, const Table &b) {
+        if (&a == &b) {
+            return std::move(a);
+        }
+        if (a.size() <= b.size()) {
+            a.erase_if([&](const value_type &el) {
+                return !b.contains(a.key_of(el));
+            });
+            return std::move(a);
+        }
+        Table res = Table::empty_like(a, b.size(), a.get_allocator());
+        for (const value_type &el: b) {
+            auto it = a.find(b.key_of(el));
+            if (it != a.end()) {
+                res.take(a, it);
+            }
+        }
+        return res;
+    }
+
+    static Table unite(const Table &a, const Table &b) {
+        const Table &large = a.size() >= b.size() ? a : b;
+        const Table &small = &large == &a ? b : a;
+        Table res = Table::copy_like(large, a.size() + b.size(), a.get_allocator());
+        for (const value_type &el: small) {
+            auto [it, inserted] = res.insert(el);
+            if (!inserted && &small == &a) {
+                keep_left(*it, el);
+            }
+        }
+        return res;
+    }
+
+    static Table unite(Table &&a, Table &&b) {
+        if (a.size() >= b.size()) {
+            a.merge(b);
+            return std::move(a);
+        }
+        b.reserve(a.size() + b.size());
+        while (!a.empty()) {
+            auto first = a.begin();
+            auto [it, moved] = b.take(a, first);
+            if (!moved) {
+                keep_left(*it, std::move(*first));
+                a.erase(first);
+            }
+        }
+        return std::move(b);
+    }
+
+    static Table difference(const Table &a, const Table &b) {
+        if (b.size() < a.size()) {
+            Table res = Table::copy_like(a, a.size(), a.get_allocator());
+            for (const value_type &el: b) {
+                res.erase(b.key_of(el));
+            }
+            return res;
+        }
+        Table res = Table::empty_like(a, a.size(), a.get_allocator());
+        for (const value_type &el: a) {
+            if (!b.contains(a.key_of(el))) {
+                res.insert(el);
+            }
+        }
+        return res;
+    }
+
+    static Table difference(Table &&a, const Table &b) {
+        if (&a == &b) {
+            a.clear();
+        } else if (b.size() < a.size()) {
+            for (const value_type &el: b) {
+                a.erase(b.key_of(el));
+            }
+        } else {
+            a.erase_if([&](const value_type &el) {
+                return b.contains(a.key_of(el));
+            });
+        }
+        return std::move(a);
+    }
+
+private:
+    // `into` holds the key of `left` already; set elements with equal keys
+    // are as good as one another, map values are overwritten
+    template<class V>
+    static void keep_left(value_type &into, V &&left) {
+        if constexpr (!std::is_same_v<typename Table::key_type, value_type>) {
+            into.second = std::forward<V>(left).second;
+        }
+    }
+};
@@ -0,0 +1,885 @@
+#pragma once
+
+#include "policy.h"
+#include "hash_table.h"
+#include "small_hash_table.h"
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// HashTable that grows without a stall: when the current table is full,
+// a new one takes over and the old one is kept for lookups; inserts and
+// erases move `Step` of its slots at a time into the new one until it is
+// drained. The new table's arrays are taken from the allocator unfilled and
+// cleared a chunk per insert while the current table fills up, and the
+// drained ones are kept to be reused, so no single operation touches every
+// slot. A key lives in exactly one of the two tables. Lookups search both
+// but never move anything, so they don't invalidate iterators; iteration
+// visits the old table first. Operations that must see a single table
+// (rehash, reserve, changing max_load_factor) finish the migration first
+template<
+        class Key,
+        class Value,
+        class KeyOf,
+        class CollisionPolicy,
+        class Hash,
+        class Equal,
+        class Storage,
+        class IndexPolicy,
+        class StatsPolicy,
+        class Allocator,
+        std::size_t Step
+>
+class IncrementalHashTable {
+private:
+    using Table = HashTable<Key, Value, KeyOf, CollisionPolicy, Hash, Equal, Storage, IndexPolicy, StatsPolicy,
+            Allocator>;
+    using slot_type = typename Table::slot_type;
+
+    // the old table has to be drained before the new one fills up, or the
+    // insert that fills it finishes the migration at once: a same size
+    // rebuild starts at half the load limit with as many slots, so every
+    // insert must move at least 2 / max_load_factor old slots
+    static_assert(Step * Table::template policy_load_factor<CollisionPolicy>() >= 2,
+                  "IncrementalRehash: Step must be at least 2 / max_load_factor of the collision policy");
+
+    template<class V>
+    class IncrementalIterator {
+    private:
+        static constexpr bool is_const = std::is_const_v<V>;
+        using It = std::conditional_t<is_const, typename Table::const_iterator, typename Table::iterator>;
+        using table_pointer = std::conditional_t<is_const, const Table *, Table *>;
+
+        It it_;
+        It old_end_;
+        // iteration continues with this table once the old one is exhausted
+        table_pointer next_;
+        bool in_old_;
+
+        friend IncrementalHashTable;
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::remove_const_t<V>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = V *;
+        using reference = V &;
+
+        IncrementalIterator(It it, It old_end, table_pointer next, bool in_old) : it_(it), old_end_(old_end),
+                                                                                  next_(next), in_old_(in_old) {
+            if (in_old_ && it_ == old_end_) {
+                it_ = next_->begin();
+                in_old_ = false;
+            }
+        }
+
+        IncrementalIterator(const IncrementalIterator &other) = default;
+
+        IncrementalIterator &operator=(const IncrementalIterator &other) = default;
+
+        reference operator*() const {
+            return *it_;
+        }
+
+        pointer operator->() const {
+            return &*it_;
+        }
+
+        IncrementalIterator &operator++() {
+            ++it_;
+            if (in_old_ && it_ == old_end_) {
+                it_ = next_->begin();
+                in_old_ = false;
+            }
+            return *this;
+        }
+
+        IncrementalIterator operator+(std::size_t shift) {
+            auto tmp = *this;
+            for (std::size_t i = 0; i < shift; ++i) {
+                ++tmp;
+            }
+            return tmp;
+        }
+
+        IncrementalIterator operator++(int) {
+            auto tmp = *this;
+            ++(*this);
+            return tmp;
+        }
+
+        bool operator==(const IncrementalIterator &other) const {
+            return other.it_ == it_;
+        }
+
+        bool operator!=(const IncrementalIterator &other) const {
+            return !(*this == other);
+        }
+
+        operator IncrementalIterator<const V>() const {
+            return IncrementalIterator<const V>(it_, old_end_, next_, in_old_);
+        }
+    };
+
+public:
+    using key_type = Key;
+    using value_type = Value;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using hasher = Hash;
+    using key_equal = Equal;
+    using allocator_type = Allocator;
+    using reference = value_type &;
+    using const_reference = const value_type &;
+    using pointer = value_type *;
+    using const_pointer = const value_type *;
+
+    using iterator = IncrementalIterator<value_type>;
+    using const_iterator = IncrementalIterator<const value_type>;
+    using node_type = typename Table::node_type;
+
+    struct insert_return_type {
+        iterator position;
+        bool inserted;
+        node_type node;
+    };
+
+    static constexpr bool transparent_lookup = Table::transparent_lookup;
+
+    explicit IncrementalHashTable(size_type expected_max_size = 1,
+                                  const hasher &hash = hasher(),
+                                  const key_equal &equal = key_equal(),
+                                  const KeyOf &key_of = KeyOf(),
+                                  const allocator_type &alloc = allocator_type()) : cur_(expected_max_size, hash,
+                                                                                         equal, key_of, alloc),
+                                                                                    old_(typename Table::no_slots_t(),
+                                                                                         hash, equal, key_of,
+                                                                                         alloc) {}
+
+    explicit IncrementalHashTable(const allocator_type &alloc) : IncrementalHashTable(1, hasher(), key_equal(),
+                                                                                      KeyOf(), alloc) {}
+
+    template<class InputIt>
+    IncrementalHashTable(InputIt first, InputIt last,
+                         size_type expected_max_size = 1,
+                         const hasher &hash = hasher(),
+                         const key_equal &equal = key_equal(),
+                         const KeyOf &key_of = KeyOf(),
+                         const allocator_type &alloc = allocator_type()) : IncrementalHashTable(expected_max_size,
+                                                                                                hash, equal, key_of,
+                                                                                                alloc) {
+        insert(first, last);
+    }
+
+    IncrementalHashTable(std::initializer_list<value_type> init,
+                         size_type expected_max_size = 1,
+                         const hasher &hash = hasher(),
+                         const key_equal &equal = key_equal(),
+                         const KeyOf &key_of = KeyOf(),
+                         const allocator_type &alloc = allocator_type()) : IncrementalHashTable(
+            std::max(expected_max_size, init.size()), hash, equal, key_of, alloc) {
+        insert(init);
+    }
+
+    IncrementalHashTable(const IncrementalHashTable &o, const allocator_type &alloc) : cur_(o.cur_, alloc),
+                                                                                       old_(o.old_, alloc),
+                                                                                       cursor_(o.cursor_) {}
+
+    IncrementalHashTable(IncrementalHashTable &&o, const allocator_type &alloc) : cur_(std::move(o.cur_), alloc),
+                                                                                  old_(std::move(o.old_), alloc),
+                                                                                  cursor_(o.cursor_) {}
+
+    // the arrays prepared for the next migration are not copied
+    IncrementalHashTable(const IncrementalHashTable &o) : cur_(o.cur_), old_(o.old_), cursor_(o.cursor_) {}
+
+    IncrementalHashTable(IncrementalHashTable &&) noexcept = default;
+
+    IncrementalHashTable &operator=(const IncrementalHashTable &o) {
+        if (this != &o) {
+            cur_ = o.cur_;
+            old_ = o.old_;
+            cursor_ = o.cursor_;
+        }
+        return *this;
+    }
+
+    IncrementalHashTable &operator=(IncrementalHashTable &&) noexcept = default;
+
+    IncrementalHashTable &operator=(std::initializer_list<value_type> init) {
+        clear();
+        insert(init);
+        return *this;
+    }
+
+    iterator begin() noexcept {
+        return migrating() ? iterator(old_.begin(), old_.end(), &cur_, true) : end_of(cur_.begin());
+    }
+
+    const_iterator begin() const noexcept {
+        return migrating() ? const_iterator(old_.begin(), old_.end(), &cur_, true) : end_of(cur_.begin());
+    }
+
+    const_iterator cbegin() const noexcept {
+        return begin();
+    }
+
+    iterator end() noexcept {
+        return end_of(cur_.end());
+    }
+
+    const_iterator end() const noexcept {
+        return end_of(cur_.end());
+    }
+
+    const_iterator cend() const noexcept {
+        return end();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_type size() const {
+        return cur_.size() + old_.size();
+    }
+
+    size_type max_size() const {
+        return cur_.max_size();
+    }
+
+    allocator_type get_allocator() const {
+        return cur_.get_allocator();
+    }
+
+    hasher hash_function() const {
+        return cur_.hash_function();
+    }
+
+    key_equal key_eq() const {
+        return cur_.key_eq();
+    }
+
+    void clear() {
+        release_old();
+        cur_.clear();
+    }
+
+    std::pair<iterator, bool> insert(const value_type &value) {
+        return emplace(value);
+    }
+
+    std::pair<iterator, bool> insert(value_type &&value) {
+        return emplace(std::move(value));
+    }
+
+    iterator insert(const_iterator, const value_type &value) {
+        return emplace(value).first;
+    }
+
+    iterator insert(const_iterator, value_type &&value) {
+        return emplace(std::move(value)).first;
+    }
+
+    template<class InputIt>
+    void insert(InputIt first, InputIt last) {
+        for (auto i = first; i != last; ++i) {
+            emplace(*i);
+        }
+    }
+
+    void insert(std::initializer_list<value_type> init) {
+        for (const auto &i : init) {
+            emplace(i);
+        }
+    }
+
+    // prefetches into the current table only: that's where the elements go
+    template<std::forward_iterator It>
+    void insert_batch(It first, It last) {
+        Table::for_each_batch(first, last, [&](const auto &value) {
+            return cur_.prefetched_hash(cur_.key_of_(value));
+        }, [&](const auto &value, size_type hash) {
+            make_room();
+            settled_insert_with(cur_.key_of_(value), hash, [&](slot_type &slot) {
+                slot.construct(cur_.alloc_, value);
+            });
+        });
+    }
+
+    // a bulk build is one big rehash anyway: the migration is finished and
+    // the current table reserves room for everything at once
+    template<std::random_access_iterator It>
+    void parallel_insert(It first, It last, size_type threads = 0) {
+        finish_migration();
+        cur_.parallel_insert(first, last, threads);
+    }
+
+    // while migrating, the old table is walked first; nothing moves meanwhile
+    template<class F>
+    void parallel_for_each(F &&f, size_type threads = 0) {
+        old_.parallel_for_each(f, threads);
+        cur_.parallel_for_each(f, threads);
+    }
+
+    template<class F>
+    void parallel_for_each(F &&f, size_type threads = 0) const {
+        old_.parallel_for_each(f, threads);
+        cur_.parallel_for_each(f, threads);
+    }
+
+    template<class... Args>
+    std::pair<iterator, bool> emplace(Args &&... args) {
+        if constexpr (sizeof...(Args) == 1 && (std::is_same_v<std::remove_cvref_t<Args>, value_type> && ...)) {
+            return emplace_key(cur_.key_of_(args)..., std::forward<Args>(args)...);
+        } else {
+            // the element has to come from the allocator of the table it goes to
+            make_room();
+            typename Table::Holder tmp(cur_.alloc_, std::forward<Args>(args)...);
+            const auto &key = cur_.key_of_(tmp.value());
+            return settled_insert_with(key, cur_.hash_of(key), [&](slot_type &slot) {
+                tmp.move_to(slot);
+            });
+        }
+    }
+
+    template<class K, class... Args>
+    std::pair<iterator, bool> emplace_key(const K &key, Args &&... args) {
+        return insert_with(key, [&](slot_type &slot) {
+            slot.construct(cur_.alloc_, std::forward<Args>(args)...);
+        });
+    }
+
+    template<class... Args>
+    iterator emplace_hint(const_iterator, Args &&... args) {
+        return emplace(std::forward<Args>(args)...).first;
+    }
+
+    // doesn't migrate, so erasing while iterating visits every element once
+    iterator erase(const_iterator pos) {
+        if (pos.in_old_) {
+            return iterator(old_.erase(pos.it_), old_.end(), &cur_, true);
+        }
+        return end_of(cur_.erase(pos.it_));
+    }
+
+    iterator erase(const_iterator first, const_iterator last) {
+        auto n = std::distance(first, last);
+        iterator res = first.in_old_ ? iterator(old_.mutable_iterator(first.it_), old_.end(), &cur_, true)
+                                     : end_of(cur_.mutable_iterator(first.it_));
+        for (; n > 0; --n) {
+            res = erase(res);
+        }
+        return res;
+    }
+
+    size_type erase(const key_type &key) {
+        return erase_key(key);
+    }
+
+    template<class K>
+    requires (transparent_lookup && !std::is_convertible_v<K, iterator> && !std::is_convertible_v<K, const_iterator>)
+    size_type erase(K &&key) {
+        return erase_key(key);
+    }
+
+    // sweeps the old table, then the current one; robin hood compaction may
+    // move old elements back below the cursor, so migration resumes from the
+    // lowest one left
+    template<class Pred>
+    size_type erase_if(Pred &&pred) {
+        size_type res;
+        try {
+            res = old_.erase_if(pred);
+        } catch (...) {
+            settle_cursor();
+            throw;
+        }
+        settle_cursor();
+        return res + cur_.erase_if(pred);
+    }
+
+    // like erase(pos), doesn't migrate
+    node_type extract(const_iterator pos) {
+        return pos.in_old_ ? old_.extract(pos.it_) : cur_.extract(pos.it_);
+    }
+
+    node_type extract(const key_type &key) {
+        return extract_key(key);
+    }
+
+    template<class K>
+    requires (transparent_lookup && !std::is_convertible_v<K, iterator> && !std::is_convertible_v<K, const_iterator>)
+    node_type extract(K &&key) {
+        return extract_key(key);
+    }
+
+    insert_return_type insert(node_type &&node) {
+        if (node.empty()) {
+            return {end(), false, node_type()};
+        }
+        make_room();
+        size_type hash = cur_.node_hash(node);
+        if (migrating()) {
+            size_type id = old_.find_index(key_of(node.value()), hash);
+            if (id != npos) {
+                return {iterator(old_.iterator_at(id), old_.end(), &cur_, true), false, std::move(node)};
+            }
+        }
+        auto [id, inserted] = cur_.insert_node(node, hash);
+        if (!inserted) {
+            return {end_of(cur_.iterator_at(id)), false, std::move(node)};
+        }
+        return {end_of(cur_.iterator_at(id)), true, node_type()};
+    }
+
+    // both migrations are finished first, then the current tables merge
+    // slot to slot, see HashTable::merge
+    void merge(IncrementalHashTable &source) {
+        if (&source == this || source.empty()) {
+            return;
+        }
+        source.finish_migration();
+        reserve(size() + source.size());
+        cur_.merge(source.cur_);
+    }
+
+    void merge(IncrementalHashTable &&source) {
+        merge(source);
+    }
+
+    void swap(IncrementalHashTable &&other) noexcept {
+        cur_.swap(std::move(other.cur_));
+        old_.swap(std::move(other.old_));
+        next_ctrl_.swap(other.next_ctrl_);
+        next_slots_.swap(other.next_slots_);
+        std::swap(cursor_, other.cursor_);
+    }
+
+    size_type count(const key_type &key) const {
+        return contains(key) ? 1 : 0;
+    }
+
+    template<class K>
+    requires transparent_lookup
+    size_type count(const K &key) const {
+        return contains(key) ? 1 : 0;
+    }
+
+    iterator find(const key_type &key) {
+        return find_impl(*this, key);
+    }
+
+    const_iterator find(const key_type &key) const {
+        return find_impl(*this, key);
+    }
+
+    template<class K>
+    requires transparent_lookup
+    iterator find(const K &key) {
+        return find_impl(*this, key);
+    }
+
+    template<class K>
+    requires transparent_lookup
+    const_iterator find(const K &key) const {
+        return find_impl(*this, key);
+    }
+
+    // while migrating, home slots are prefetched in both tables
+    template<std::forward_iterator It, class Found>
+    void find_batch(It first, It last, Found &&found) {
+        find_batch_impl(*this, first, last, found);
+    }
+
+    template<std::forward_iterator It, class Found>
+    void find_batch(It first, It last, Found &&found) const {
+        find_batch_impl(*this, first, last, found);
+    }
+
+    bool contains(const key_type &key) const {
+        return find(key) != end();
+    }
+
+    template<class K>
+    requires transparent_lookup
+    bool contains(const K &key) const {
+        return find(key) != end();
+    }
+
+    std::pair<iterator, iterator> equal_range(const key_type &key) {
+        auto tmp = find(key);
+        return tmp == end() ? std::make_pair(end(), end()) : std::make_pair(tmp, tmp + 1);
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(const key_type &key) const {
+        auto tmp = find(key);
+        return tmp == cend() ? std::make_pair(cend(), cend()) : std::make_pair(tmp, tmp + 1);
+    }
+
+    template<class K>
+    requires transparent_lookup
+    std::pair<iterator, iterator> equal_range(const K &key) {
+        auto tmp = find(key);
+        return tmp == end() ? std::make_pair(end(), end()) : std::make_pair(tmp, tmp + 1);
+    }
+
+    template<class K>
+    requires transparent_lookup
+    std::pair<const_iterator, const_iterator> equal_range(const K &key) const {
+        auto tmp = find(key);
+        return tmp == cend() ? std::make_pair(cend(), cend()) : std::make_pair(tmp, tmp + 1);
+    }
+
+    // buckets of the table new elements go to
+    size_type bucket_count() const {
+        return cur_.bucket_count();
+    }
+
+    size_type max_bucket_count() const {
+        return cur_.max_bucket_count();
+    }
+
+    size_type bucket_size(const size_type) const {
+        return 1;
+    }
+
+    size_type bucket(const key_type &key) const {
+        return cur_.bucket(key);
+    }
+
+    float load_factor() const {
+        return size() * 1. / bucket_count();
+    }
+
+    float max_load_factor() const {
+        return cur_.max_load_factor();
+    }
+
+    void max_load_factor(float ml) {
+        if (ml * Step < 2) {
+            throw std::invalid_argument("IncrementalHashTable: max_load_factor too low for the migration step");
+        }
+        finish_migration();
+        cur_.max_load_factor(ml);
+    }
+
+    void rehash(size_type count) {
+        finish_migration();
+        cur_.rehash(count);
+    }
+
+    void reserve(size_type count) {
+        finish_migration();
+        cur_.reserve(count);
+    }
+
+    // both tables together; a running migration counts as one rehash,
+    // its time is only the allocation of the new arrays
+    HashTableStats stats() const requires StatsPolicy::enabled {
+        HashTableStats res = cur_.stats();
+        if (migrating()) {
+            HashTableStats old = old_.stats();
+            res.size += old.size;
+            res.tombstones += old.tombstones;
+            res.load_factor = load_factor();
+            if (res.probe_lengths.size() < old.probe_lengths.size()) {
+                res.probe_lengths.resize(old.probe_lengths.size());
+            }
+            for (size_type i = 0; i < old.probe_lengths.size(); ++i) {
+                res.probe_lengths[i] += old.probe_lengths[i];
+            }
+            res.longest_probe = res.probe_lengths.size();
+            res.mean_probe = res.size == 0 ? 0 : (res.mean_probe * cur_.size() + old.mean_probe * old.size) /
+                                                 res.size;
+        }
+        return res;
+    }
+
+    // of both tables together, see HashTable::fingerprint
+    size_type fingerprint() const {
+        return cur_.fingerprint() + old_.fingerprint();
+    }
+
+    friend bool operator==(const IncrementalHashTable &lhs, const IncrementalHashTable &rhs) {
+        if (lhs.size() != rhs.size()) return false;
+        if constexpr (std::is_empty_v<hasher>) {
+            if (lhs.fingerprint() != rhs.fingerprint()) return false;
+        }
+        for (auto const &el: lhs) {
+            auto it = rhs.find(lhs.key_of(el));
+            if (it == rhs.end() || !same_value(el, *it)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    friend bool operator!=(const IncrementalHashTable &lhs, const IncrementalHashTable &rhs) {
+        return !(lhs == rhs);
+    }
+
+private:
+    static constexpr size_type npos = Table::npos;
+
+    template<class>
+    friend struct SetAlgebra;
+
+    const auto &key_of(const value_type &value) const {
+        return cur_.key_of_(value);
+    }
+
+    static bool same_value(const value_type &a, const value_type &b) {
+        return Table::same_value(a, b);
+    }
+
+    static IncrementalHashTable empty_like(const IncrementalHashTable &o, size_type count,
+                                           const allocator_type &alloc) {
+        IncrementalHashTable res(alloc);
+        res.cur_ = Table::empty_like(o.cur_, count, alloc);
+        return res;
+    }
+
+    static IncrementalHashTable copy_like(const IncrementalHashTable &o, size_type count,
+                                          const allocator_type &alloc) {
+        IncrementalHashTable res(o, alloc);
+        res.reserve(count);
+        return res;
+    }
+
+    // see HashTable::take; `pos` is looked up here first, so that it is
+    // only extracted to be inserted
+    std::pair<iterator, bool> take(IncrementalHashTable &src, const_iterator pos) {
+        auto it = find(key_of(*pos));
+        if (it != end()) {
+            return {it, false};
+        }
+        return {insert(src.extract(pos)).position, true};
+    }
+
+    template<class K>
+    node_type extract_key(const K &key) {
+        auto it = find(key);
+        if (it == end()) {
+            return node_type();
+        }
+        node_type res = extract(it);
+        if (migrating()) {
+            migrate(Step);
+        }
+        return res;
+    }
+
+    bool migrating() const {
+        return old_.bucket_count() != 0;
+    }
+
+    iterator end_of(typename Table::iterator it) {
+        return iterator(it, old_.end(), &cur_, false);
+    }
+
+    const_iterator end_of(typename Table::const_iterator it) const {
+        return const_iterator(it, old_.end(), &cur_, false);
+    }
+
+    template<class Self, class K>
+    static auto find_impl(Self &self, const K &key) {
+        return find_impl(self, key, self.cur_.hash_of(key));
+    }
+
+    template<class Self, class It, class Found>
+    static void find_batch_impl(Self &self, It first, It last, Found &found) {
+        Table::for_each_batch(first, last, [&](const auto &key) {
+            size_type hash = self.cur_.prefetched_hash(key);
+            if (self.migrating()) {
+                self.old_.prefetch_home(hash);
+            }
+            return hash;
+        }, [&](const auto &key, size_type hash) {
+            found(find_impl(self, key, hash));
+        });
+    }
+
+    template<class Self, class K>
+    static auto find_impl(Self &self, const K &key, size_type hash) {
+        size_type id = self.cur_.find_index(key, hash);
+        if (id == npos && self.migrating() && (id = self.old_.find_index(key, hash)) != npos) {
+            return decltype(self.begin())(self.old_.iterator_at(id), self.old_.end(), &self.cur_, true);
+        }
+        return self.end_of(self.cur_.iterator_at(self.cur_.index_or_end(id)));
+    }
+
+    template<class K, class Fill>
+    std::pair<iterator, bool> insert_with(const K &key, Fill &&fill) {
+        make_room();
+        return settled_insert_with(key, cur_.hash_of(key), std::forward<Fill>(fill));
+    }
+
+    // does this insertion's share of migration, so that nothing moves before
+    // the element is in place
+    void make_room() {
+        if (migrating()) {
+            migrate(Step);
+        } else {
+            prepare_next();
+        }
+        if (cur_.cells_cnt_ + 1 > cur_.max_load_factor() * cur_.home_count()) {
+            start_migration();
+        }
+    }
+
+    // clears the next chunk of the arrays the next migration moves into,
+    // sized for twice the current table; chunks are spread over half the
+    // inserts the current table has left before it is full
+    void prepare_next() {
+        size_type count = Table::capacity_for_buckets(cur_.home_count() * 2);
+        size_type buckets = count + Table::overflow_for(count);
+        size_type done = next_ctrl_.size();
+        if (done >= buckets) {
+            return;
+        }
+        if (next_ctrl_.capacity() < buckets) {
+            // taken without initializing; arrays kept from the last migration
+            // that are too small are let go of here
+            typename Table::ctrl_vector ctrl(next_ctrl_.get_allocator());
+            typename Table::slot_vector slots(next_slots_.get_allocator());
+            ctrl.reserve(buckets);
+            slots.reserve(buckets);
+            next_ctrl_.swap(ctrl);
+            next_slots_.swap(slots);
+            done = 0;
+        }
+        auto limit = static_cast<size_type>(cur_.max_load_factor() * cur_.home_count());
+        size_type left = std::max<size_type>(1, (limit - std::min(limit, cur_.cells_cnt_)) / 2);
+        size_type n = std::min(buckets, done + (buckets - done + left - 1) / left);
+        next_ctrl_.resize(n, CTRL_FREE);
+        next_slots_.resize(n);
+    }
+
+    // after make_room(): the tables are settled and `key` can be looked for in both
+    template<class K, class Fill>
+    std::pair<iterator, bool> settled_insert_with(const K &key, size_type hash, Fill &&fill) {
+        if (migrating()) {
+            size_type id = old_.find_index(key, hash);
+            if (id != npos) {
+                return {iterator(old_.iterator_at(id), old_.end(), &cur_, true), false};
+            }
+        }
+        auto [id, inserted] = cur_.insert_with(key, hash, std::forward<Fill>(fill));
+        return {end_of(cur_.iterator_at(id)), inserted};
+    }
+
+    template<class K>
+    size_type erase_key(const K &key) {
+        size_type hash = cur_.hash_of(key);
+        size_type id = cur_.find_index(key, hash);
+        if (id != npos) {
+            cur_.erase_at(id, hash);
+        } else if (migrating() && (id = old_.find_index(key, hash)) != npos) {
+            old_.erase_at(id, hash);
+        } else {
+            return 0;
+        }
+        if (migrating()) {
+            migrate(Step);
+        }
+        return 1;
+    }
+
+    // current table is full: it becomes the old one, and new elements go to
+    // a fresh table, twice as large unless most of the cells are tombstones
+    void start_migration() {
+        finish_migration();
+        size_type count = cur_.size() + 1 > cur_.max_load_factor() * cur_.home_count() / 2
+                          ? Table::capacity_for_buckets(cur_.home_count() * 2)
+                          : Table::capacity_for_buckets(cur_.home_count());
+        Table next(typename Table::no_slots_t(), cur_.hash_, cur_.equal_, cur_.key_of_, cur_.get_allocator());
+        next.max_load_factor_ = cur_.max_load_factor_;
+        // statistics keep following the table new elements go to
+        std::swap(next.stats_, cur_.stats_);
+        {
+            typename Table::RehashScope scope(next.stats_);
+            size_type buckets = count + Table::overflow_for(count);
+            if (next_ctrl_.capacity() >= buckets && next_ctrl_.get_allocator() == next.ctrl_.get_allocator() &&
+                next_slots_.get_allocator() == next.slots_.get_allocator()) {
+                // prepare_next() normally cleared all of them already
+                next_ctrl_.resize(buckets, CTRL_FREE);
+                next_slots_.resize(buckets);
+                next.allocate_from(next_ctrl_, next_slots_);
+            } else {
+                next.allocate(count);
+            }
+        }
+        old_.swap(std::move(cur_));
+        cur_.swap(std::move(next));
+        cursor_ = 0;
+    }
+
+    // moves up to `limit` slots of the old table into the current one
+    void migrate(size_type limit) {
+        for (size_type n = 0; n < limit && old_.size() != 0; ++n) {
+            // robin hood erase shifts the next element into `cursor_`, so it only
+            // moves on past slots that stay empty
+            if (is_full(old_.ctrl_[cursor_])) {
+                old_.transfer(cursor_, cur_);
+            } else {
+                ++cursor_;
+            }
+        }
+        if (old_.size() == 0) {
+            release_old();
+        }
+    }
+
+    void settle_cursor() {
+        cursor_ = std::min(cursor_, old_.first_full_);
+        if (migrating() && old_.size() == 0) {
+            release_old();
+        }
+    }
+
+    void finish_migration() {
+        if (migrating()) {
+            migrate(npos);
+        }
+    }
+
+    // the arrays of a drained old table are kept for prepare_next(), which
+    // reuses them for a same size rebuild, rather than freed by the
+    // operation that drained them
+    void release_old() {
+        if (migrating() && old_.size() == 0 && next_ctrl_.capacity() < old_.ctrl_.capacity() &&
+            next_ctrl_.get_allocator() == old_.ctrl_.get_allocator() &&
+            next_slots_.get_allocator() == old_.slots_.get_allocator()) {
+            next_ctrl_.swap(old_.ctrl_);
+            next_slots_.swap(old_.slots_);
+            next_ctrl_.clear();
+            next_slots_.clear();
+        }
+        Table released(std::move(old_));
+        cursor_ = 0;
+    }
+
+    Table cur_;
+    Table old_;
+    // arrays of the table the next migration moves into, see prepare_next()
+    typename Table::ctrl_vector next_ctrl_{cur_.ctrl_.get_allocator()};
+    typename Table::slot_vector next_slots_{cur_.slots_.get_allocator()};
+    // old slots below it are migrated already
+    size_type cursor_ = 0;
+};
+
+// HashTable, IncrementalHashTable or SmallHashTable, as chosen by the resize policy
+template<class Key, class Value, class KeyOf, class CollisionPolicy, class Hash, class Equal, class Storage,
+        class IndexPolicy, class StatsPolicy, class ResizePolicy, class Allocator>
+using select_table_t = std::conditional_t<
+        (ResizePolicy::migration_step > 0),
+        IncrementalHashTable<Key, Value, KeyOf, CollisionPolicy, Hash, Equal, Storage, IndexPolicy, StatsPolicy,
+                Allocator, ResizePolicy::migration_step>,
+        std::conditional_t<
+                (ResizePolicy::inline_capacity > 0),
+                SmallHashTable<Key, Value, KeyOf, CollisionPolicy, Hash, Equal, Storage, IndexPolicy, StatsPolicy,
+                        Allocator, ResizePolicy::inline_capacity>,
+                HashTable<Key, Value, KeyOf, CollisionPolicy, Hash, Equal, Storage, IndexPolicy, StatsPolicy,
+                        Allocator>>>;
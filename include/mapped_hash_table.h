@@ -0,0 +1,244 @@
+#pragma once
+
+#include "hash_table.h"
+#include <cerrno>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// read-only table over a file written by HashTable::save (HashMap::save,
+// HashSet::save): the file is mapped into memory and lookups probe its pages
+// directly, so opening parses, copies and allocates nothing, however large
+// the table is; pages are faulted in as they are touched.
+// The file must come from a table of the same key, value, storage and
+// policies, which is checked on open; its contents are trusted otherwise.
+// POSIX only
+template<class Table>
+class MappedHashTable {
+private:
+    using slot_type = typename Table::slot_type;
+
+    static_assert(requires(const Table &t, std::ostream &out) { t.save(out); },
+                  "MappedHashTable: only flat tables of trivially copyable elements can be mapped");
+
+public:
+    using key_type = typename Table::key_type;
+    using value_type = typename Table::value_type;
+    using size_type = typename Table::size_type;
+    using hasher = typename Table::hasher;
+    using key_equal = typename Table::key_equal;
+    using const_iterator = typename Table::const_iterator;
+    using iterator = const_iterator;
+
+    explicit MappedHashTable(const std::string &path, const hasher &hash = hasher(),
+                             const key_equal &equal = key_equal()) : probe_(typename Table::no_slots_t(), hash,
+                                                                            equal, {}, {}) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "MappedHashTable: cannot open " + path);
+        }
+        struct stat st{};
+        if (::fstat(fd, &st) != 0) {
+            int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "MappedHashTable: cannot stat " + path);
+        }
+        length_ = static_cast<std::size_t>(st.st_size);
+        if (length_ < sizeof(SavedTableHeader)) {
+            ::close(fd);
+            throw std::runtime_error("MappedHashTable: " + path + " is not a saved table");
+        }
+        data_ = ::mmap(nullptr, length_, PROT_READ, MAP_PRIVATE, fd, 0);
+        int error = errno;
+        // the mapping keeps the file alive on its own
+        ::close(fd);
+        if (data_ == MAP_FAILED) {
+            data_ = nullptr;
+            throw std::system_error(error, std::generic_category(), "MappedHashTable: cannot map " + path);
+        }
+        try {
+            attach(path);
+        } catch (...) {
+            unmap();
+            throw;
+        }
+    }
+
+    MappedHashTable(const MappedHashTable &) = delete;
+
+    MappedHashTable &operator=(const MappedHashTable &) = delete;
+
+    MappedHashTable(MappedHashTable &&other) noexcept: probe_(std::move(other.probe_)),
+                                                       data_(std::exchange(other.data_, nullptr)),
+                                                       length_(std::exchange(other.length_, 0)),
+                                                       ctrl_(std::exchange(other.ctrl_, nullptr)),
+                                                       slots_(std::exchange(other.slots_, nullptr)),
+                                                       size_(std::exchange(other.size_, 0)),
+                                                       buckets_(std::exchange(other.buckets_, 0)) {}
+
+    MappedHashTable &operator=(MappedHashTable &&other) noexcept {
+        if (this != &other) {
+            unmap();
+            probe_ = std::move(other.probe_);
+            data_ = std::exchange(other.data_, nullptr);
+            length_ = std::exchange(other.length_, 0);
+            ctrl_ = std::exchange(other.ctrl_, nullptr);
+            slots_ = std::exchange(other.slots_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+            buckets_ = std::exchange(other.buckets_, 0);
+        }
+        return *this;
+    }
+
+    ~MappedHashTable() {
+        unmap();
+    }
+
+    size_type size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    size_type bucket_count() const {
+        return buckets_;
+    }
+
+    const_iterator begin() const {
+        const ctrl_t *first = next_full_ctrl(ctrl_, ctrl_ + buckets_);
+        return iterator_at(first - ctrl_);
+    }
+
+    const_iterator end() const {
+        return iterator_at(buckets_);
+    }
+
+    const_iterator cbegin() const {
+        return begin();
+    }
+
+    const_iterator cend() const {
+        return end();
+    }
+
+    const_iterator find(const key_type &key) const {
+        return iterator_at(find_index(key));
+    }
+
+    template<class K>
+    requires Table::transparent_lookup
+    const_iterator find(const K &key) const {
+        return iterator_at(find_index(key));
+    }
+
+    bool contains(const key_type &key) const {
+        return find_index(key) != buckets_;
+    }
+
+    template<class K>
+    requires Table::transparent_lookup
+    bool contains(const K &key) const {
+        return find_index(key) != buckets_;
+    }
+
+    size_type count(const key_type &key) const {
+        return contains(key) ? 1 : 0;
+    }
+
+    template<class K>
+    requires Table::transparent_lookup
+    size_type count(const K &key) const {
+        return contains(key) ? 1 : 0;
+    }
+
+private:
+    // checks the header against this table type and points at the arrays
+    void attach(const std::string &path) {
+        const auto *header = static_cast<const SavedTableHeader *>(data_);
+        if (std::memcmp(header->magic, SavedTableHeader::expected_magic, sizeof(header->magic)) != 0) {
+            throw std::runtime_error("MappedHashTable: " + path + " is not a saved table");
+        }
+        if (header->byte_order != SavedTableHeader::expected_byte_order) {
+            throw std::runtime_error("MappedHashTable: " + path + " was saved with another byte order");
+        }
+        if (header->layout != probe_.layout_signature()) {
+            throw std::runtime_error("MappedHashTable: " + path + " was saved by a table of another layout");
+        }
+        if (header->file_size != length_ || header->bucket_count > length_ ||
+            header->ctrl_offset < sizeof(SavedTableHeader) ||
+            header->ctrl_offset + header->bucket_count > header->slots_offset ||
+            header->slots_offset % SavedTableHeader::alignment != 0 || header->slots_offset > length_ ||
+            length_ - header->slots_offset != header->bucket_count * sizeof(slot_type)) {
+            throw std::runtime_error("MappedHashTable: " + path + " is truncated or corrupt");
+        }
+        const auto *bytes = static_cast<const unsigned char *>(data_);
+        ctrl_ = reinterpret_cast<const ctrl_t *>(bytes + header->ctrl_offset);
+        slots_ = reinterpret_cast<const slot_type *>(bytes + header->slots_offset);
+        size_ = static_cast<size_type>(header->size);
+        buckets_ = static_cast<size_type>(header->bucket_count);
+    }
+
+    void unmap() noexcept {
+        if (data_ != nullptr) {
+            ::munmap(data_, length_);
+            data_ = nullptr;
+        }
+    }
+
+    // slot of `key`, or buckets_ if it is absent
+    template<class K>
+    size_type find_index(const K &key) const {
+        if (size_ == 0) {
+            return buckets_;
+        }
+        size_type id = probe_.find_in(ctrl_, slots_, buckets_, key, probe_.hash_of(key));
+        return id == Table::npos ? buckets_ : id;
+    }
+
+    const_iterator iterator_at(size_type id) const {
+        return const_iterator(ctrl_ + id, ctrl_ + buckets_, slots_ + id);
+    }
+
+    // table without slots of its own: hasher, key_equal and the probing code
+    Table probe_;
+    void *data_ = nullptr;
+    std::size_t length_ = 0;
+    const ctrl_t *ctrl_ = nullptr;
+    const slot_type *slots_ = nullptr;
+    size_type size_ = 0;
+    size_type buckets_ = 0;
+};
+
+// views of files saved by HashMap and HashSet with the same parameters
+template<
+        class Key,
+        class T,
+        class CollisionPolicy = LinearProbing,
+        class Hash = std::hash<Key>,
+        class Equal = std::equal_to<Key>,
+        class Storage = default_storage_t<Key, Hash>,
+        class IndexPolicy = PowerOfTwoMasking
+>
+using MappedHashMap = MappedHashTable<HashTable<Key, std::pair<const Key, T>, SelectFirst, CollisionPolicy, Hash,
+        Equal, Storage, IndexPolicy>>;
+
+template<
+        class Key,
+        class CollisionPolicy = LinearProbing,
+        class Hash = std::hash<Key>,
+        class Equal = std::equal_to<Key>,
+        class Storage = default_storage_t<Key, Hash>,
+        class IndexPolicy = PowerOfTwoMasking
+>
+using MappedHashSet = MappedHashTable<HashTable<Key, Key, Identity, CollisionPolicy, Hash, Equal, Storage,
+        IndexPolicy>>;
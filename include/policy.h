@@ -1,16 +1,30 @@
 #pragma once
 
+#include "group.h"
+#include <bit>
+#include <chrono>
+#include <cstdint>
 #include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// collision policies: probe sequences over a power-of-two table of `size` slots,
+// wrapped around with a mask
 
 struct LinearProbing {
-    std::size_t size;
+    std::size_t mask;
     std::size_t currentIndex;
     std::size_t start;
 
-    LinearProbing(size_t size, size_t start) : size(size), currentIndex(0), start(start) {}
+    LinearProbing(size_t size, size_t start) : mask(size - 1), currentIndex(0), start(start) {}
 
     std::size_t operator*() {
-        return (start + currentIndex) % size;
+        return (start + currentIndex) & mask;
     }
 
     LinearProbing operator++() {
@@ -18,19 +32,513 @@ struct LinearProbing {
         return *this;
     }
 };
+
+// steps grow by one each time (triangular numbers), which unlike plain squares
+// visits every slot of a power-of-two table
 struct QuadraticProbing {
-    std::size_t size;
+    std::size_t mask;
     std::size_t currentBase;
+    std::size_t offset;
     std::size_t start;
 
-    QuadraticProbing(size_t size, size_t start) : size(size), currentBase(0), start(start) {}
+    QuadraticProbing(size_t size, size_t start) : mask(size - 1), currentBase(0), offset(0), start(start) {}
 
     std::size_t operator*() {
-        return (start + currentBase * currentBase) % size;
+        return (start + offset) & mask;
     }
 
     QuadraticProbing operator++() {
-        ++currentBase;
+        offset += ++currentBase;
         return *this;
     }
 };
+
+// Robin Hood hashing over linear probing: the table keeps each element's
+// distance from its home slot in the control byte, and keeps runs sorted by
+// it, so lookups stop at the first element closer to home than the key
+// would be; erase shifts the following elements back instead of leaving a
+// tombstone, so insert/erase churn never degrades probe lengths
+struct RobinHoodProbing {
+    static constexpr bool robin_hood = true;
+    static constexpr float max_load_factor = 0.8;
+};
+
+// Swiss-table style probing: `*it` is the first slot of a whole group of
+// `group_width` control bytes, which the table matches against 7 bits of the
+// hash with one SIMD compare, comparing keys only on matches;
+// groups are visited in triangular order, which reaches every group of a
+// power-of-two table
+struct GroupProbing {
+    static constexpr std::size_t group_width = Group::width;
+    static constexpr float max_load_factor = 0.875;
+
+    std::size_t mask;
+    std::size_t currentBase;
+    std::size_t offset;
+    std::size_t start;
+
+    GroupProbing(size_t size, size_t start) : mask(size / group_width - 1), currentBase(0), offset(0),
+                                              start(start / group_width) {}
+
+    std::size_t operator*() {
+        return ((start + offset) & mask) * group_width;
+    }
+
+    GroupProbing operator++() {
+        offset += ++currentBase;
+        return *this;
+    }
+};
+
+// index policies: map a (mixed) hash to the home slot of a power-of-two
+// table and choose the hash fragment kept in the control byte
+
+// low bits of the hash pick the slot, top 7 bits are the fragment
+struct PowerOfTwoMasking {
+    static constexpr bool self_mixing = false;
+
+    static std::size_t home(std::size_t hash, std::size_t size) {
+        return hash & (size - 1);
+    }
+
+    static ctrl_t fragment(std::size_t hash) {
+        return static_cast<ctrl_t>(hash >> (sizeof(std::size_t) * 8 - 7));
+    }
+};
+
+// Fibonacci hashing: multiply by 2^64 / phi and keep the top bits; the
+// multiplication already spreads weak hashes, so no extra mixing is done
+struct FibonacciHashing {
+    static constexpr bool self_mixing = true;
+
+    static std::size_t home(std::size_t hash, std::size_t size) {
+        constexpr std::size_t bits = sizeof(std::size_t) * 8;
+        constexpr std::size_t golden = bits == 64 ? std::size_t(0x9e3779b97f4a7c15ull) : std::size_t(0x9e3779b9u);
+        std::size_t shift = bits - std::countr_zero(size);
+        return shift == bits ? 0 : (hash * golden) >> shift;
+    }
+
+    static ctrl_t fragment(std::size_t hash) {
+        return static_cast<ctrl_t>(hash & 0x7f);
+    }
+};
+
+// hashers declaring `using is_avalanching = void;` already spread their input
+// over all bits; everything else (e.g. identity std::hash for integers) is
+// passed through `mix_hash` first
+template<class Hash>
+constexpr bool is_avalanching_v = requires { typename Hash::is_avalanching; };
+
+// murmur3 finalizer: every input bit affects every output bit
+constexpr std::size_t mix_hash(std::size_t hash) {
+    if constexpr (sizeof(std::size_t) == 8) {
+        std::uint64_t h = hash;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return static_cast<std::size_t>(h);
+    } else {
+        std::uint32_t h = static_cast<std::uint32_t>(hash);
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35u;
+        h ^= h >> 16;
+        return h;
+    }
+}
+
+// transparent hasher for std::string keys: combined with std::equal_to<>,
+// lookups by std::string_view or const char * don't build a temporary string
+struct StringHash {
+    using is_transparent = void;
+
+    std::size_t operator()(std::string_view str) const noexcept {
+        return std::hash<std::string_view>()(str);
+    }
+};
+
+// storage policies: decide where a slot of the table keeps its value;
+// cells are given the table's element allocator for every construction
+// and destruction, so elements are built with allocator_traits (and get
+// the table's memory resource under std::pmr)
+
+// value lives directly inside the slot array: no allocation per element and
+// no pointer chase on lookup, but references are invalidated by rehash
+struct FlatStorage {
+    // slots hold the elements themselves, see HashTable::save
+    static constexpr bool in_place = true;
+
+    template<class T>
+    class Cell {
+    private:
+        alignas(T) unsigned char storage_[sizeof(T)];
+    public:
+        // destroy() may be skipped when tables are torn down
+        static constexpr bool trivial_destroy = std::is_trivially_destructible_v<T>;
+
+        // left uninitialized, so allocating a table does not clear its memory
+        Cell() noexcept {}
+
+        template<class Alloc, class... Args>
+        void construct(Alloc &alloc, Args &&... args) {
+            std::allocator_traits<Alloc>::construct(alloc, reinterpret_cast<T *>(storage_),
+                                                    std::forward<Args>(args)...);
+        }
+
+        template<class Alloc>
+        void destroy(Alloc &alloc) noexcept {
+            std::allocator_traits<Alloc>::destroy(alloc, get());
+        }
+
+        // moves value of `other` into this (empty) cell, leaving `other` empty
+        template<class Alloc>
+        void relocate(Alloc &alloc, Cell &other) noexcept(std::is_nothrow_move_constructible_v<T>) {
+            construct(alloc, std::move(*other.get()));
+            other.destroy(alloc);
+        }
+
+        T *get() noexcept {
+            return std::launder(reinterpret_cast<T *>(storage_));
+        }
+
+        const T *get() const noexcept {
+            return std::launder(reinterpret_cast<const T *>(storage_));
+        }
+    };
+};
+
+// every value gets its own node from the element allocator; slower, but
+// pointers and references to elements stay valid across rehash
+struct NodeStorage {
+    template<class T>
+    class Cell {
+    private:
+        T *ptr_ = nullptr;
+    public:
+        static constexpr bool trivial_destroy = false;
+
+        template<class Alloc, class... Args>
+        void construct(Alloc &alloc, Args &&... args) {
+            T *node = std::allocator_traits<Alloc>::allocate(alloc, 1);
+            try {
+                std::allocator_traits<Alloc>::construct(alloc, node, std::forward<Args>(args)...);
+            } catch (...) {
+                std::allocator_traits<Alloc>::deallocate(alloc, node, 1);
+                throw;
+            }
+            ptr_ = node;
+        }
+
+        template<class Alloc>
+        void destroy(Alloc &alloc) noexcept {
+            std::allocator_traits<Alloc>::destroy(alloc, ptr_);
+            std::allocator_traits<Alloc>::deallocate(alloc, ptr_, 1);
+            ptr_ = nullptr;
+        }
+
+        template<class Alloc>
+        void relocate(Alloc &, Cell &other) noexcept {
+            ptr_ = other.ptr_;
+            other.ptr_ = nullptr;
+        }
+
+        T *get() noexcept {
+            return ptr_;
+        }
+
+        const T *get() const noexcept {
+            return ptr_;
+        }
+    };
+};
+
+// node allocator of PooledNodeStorage, owned by one table: nodes are carved
+// out of chunks taken from `Alloc`, which grow up to `max_chunk` nodes, and
+// freed nodes are kept for reuse; chunks are only returned when the pool
+// dies, so a warmed up table allocates nothing per insert
+template<class T, class Alloc = std::allocator<T>>
+class NodePool {
+private:
+    union Node {
+        Node *next;
+        alignas(T) unsigned char value[sizeof(T)];
+    };
+
+    using node_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
+    using chunk = std::pair<Node *, std::size_t>;
+    using chunk_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<chunk>;
+
+    static constexpr std::size_t min_chunk = 16;
+    static constexpr std::size_t max_chunk = 4096;
+
+    [[no_unique_address]] Alloc upstream_;
+    std::vector<chunk, chunk_allocator> chunks_;
+    Node *free_ = nullptr;
+public:
+    using value_type = T;
+
+    explicit NodePool(const Alloc &upstream = Alloc()) : upstream_(upstream), chunks_(chunk_allocator(upstream)) {}
+
+    // a copied table gets its own, empty pool
+    NodePool(const NodePool &other) : NodePool(
+            std::allocator_traits<Alloc>::select_on_container_copy_construction(other.upstream_)) {}
+
+    NodePool(NodePool &&other) noexcept: upstream_(std::move(other.upstream_)), chunks_(std::move(other.chunks_)),
+                                         free_(std::exchange(other.free_, nullptr)) {}
+
+    NodePool &operator=(NodePool &&other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    // the upstream allocators are exchanged only if they propagate on swap,
+    // otherwise they must be equal
+    void swap(NodePool &other) noexcept {
+        if constexpr (std::allocator_traits<Alloc>::propagate_on_container_swap::value) {
+            std::swap(upstream_, other.upstream_);
+        }
+        chunks_.swap(other.chunks_);
+        std::swap(free_, other.free_);
+    }
+
+    ~NodePool() {
+        node_allocator alloc(upstream_);
+        for (auto [nodes, count]: chunks_) {
+            std::allocator_traits<node_allocator>::deallocate(alloc, nodes, count);
+        }
+    }
+
+    // only single nodes are ever allocated
+    T *allocate(std::size_t) {
+        if (free_ == nullptr) {
+            refill();
+        }
+        Node *node = free_;
+        free_ = node->next;
+        return reinterpret_cast<T *>(node->value);
+    }
+
+    void deallocate(T *ptr, std::size_t) noexcept {
+        Node *node = ::new(static_cast<void *>(ptr)) Node;
+        node->next = free_;
+        free_ = node;
+    }
+
+    // elements are still constructed by the upstream allocator
+    template<class U, class... Args>
+    void construct(U *ptr, Args &&... args) {
+        std::allocator_traits<Alloc>::construct(upstream_, ptr, std::forward<Args>(args)...);
+    }
+
+    template<class U>
+    void destroy(U *ptr) noexcept {
+        std::allocator_traits<Alloc>::destroy(upstream_, ptr);
+    }
+
+private:
+    void refill() {
+        std::size_t count = chunks_.empty() ? min_chunk : std::min(chunks_.back().second * 2, max_chunk);
+        node_allocator alloc(upstream_);
+        chunks_.reserve(chunks_.size() + 1);
+        Node *nodes = std::allocator_traits<node_allocator>::allocate(alloc, count);
+        chunks_.emplace_back(nodes, count);
+        for (std::size_t i = count; i-- > 0;) {
+            Node *node = ::new(static_cast<void *>(nodes + i)) Node;
+            node->next = free_;
+            free_ = node;
+        }
+    }
+};
+
+// node storage whose nodes come from a NodePool owned by the table
+struct PooledNodeStorage {
+    template<class T>
+    using Cell = NodeStorage::Cell<T>;
+
+    template<class T, class Alloc>
+    using element_allocator = NodePool<T, Alloc>;
+};
+
+// allocator a table constructs its elements with: the storage policy's
+// `element_allocator` if it declares one, otherwise the table's own
+// allocator rebound to the element type
+template<class Storage, class T, class Alloc>
+struct storage_allocator {
+    using type = Alloc;
+};
+
+template<class Storage, class T, class Alloc>
+requires requires { typename Storage::template element_allocator<T, Alloc>; }
+struct storage_allocator<Storage, T, Alloc> {
+    using type = typename Storage::template element_allocator<T, Alloc>;
+};
+
+template<class Storage, class T, class Alloc>
+using storage_allocator_t = typename storage_allocator<Storage, T, Alloc>::type;
+
+// adds the element's full hash to every slot of `Storage`: probes compare
+// it before calling key_equal, and rehashing reuses it instead of hashing
+// every element again; worth its memory for slow hashers and expensive
+// key comparisons (strings, composite keys)
+template<class Storage = FlatStorage>
+struct CachedHash {
+    static constexpr bool caches_hash = true;
+    static constexpr bool in_place = requires { requires Storage::in_place; };
+
+    template<class T, class Alloc>
+    using element_allocator = storage_allocator_t<Storage, T, Alloc>;
+
+    template<class T>
+    class Cell : public Storage::template Cell<T> {
+    private:
+        using Base = typename Storage::template Cell<T>;
+
+        std::size_t hash_;
+    public:
+        template<class Alloc>
+        void relocate(Alloc &alloc, Cell &other) noexcept(noexcept(
+                std::declval<Base &>().relocate(alloc, std::declval<Base &>()))) {
+            Base::relocate(alloc, other);
+            hash_ = other.hash_;
+        }
+
+        std::size_t hash() const noexcept {
+            return hash_;
+        }
+
+        void set_hash(std::size_t hash) noexcept {
+            hash_ = hash;
+        }
+    };
+};
+
+// hashers whose result is cheaper to recompute than to store: std::hash of
+// scalars and hashers declaring `using is_fast = void;`; like libstdc++'s
+// __cache_default, everything else gets cached hashes by default, but here
+// that includes user hashers, as those are usually for composite keys
+template<class Key, class Hash>
+constexpr bool is_fast_hash_v = requires { typename Hash::is_fast; } ||
+                                (std::is_scalar_v<Key> && std::is_same_v<Hash, std::hash<Key>>);
+
+template<class Key, class Hash>
+using default_storage_t = std::conditional_t<is_fast_hash_v<Key, Hash>, FlatStorage, CachedHash<FlatStorage>>;
+
+// key extraction policies: how the table gets the key out of a stored value;
+// stateless ones are inlined away completely
+
+// key of std::pair-like values, used by HashMap
+struct SelectFirst {
+    template<class Pair>
+    constexpr const auto &operator()(const Pair &value) const noexcept {
+        return value.first;
+    }
+};
+
+// value is the key itself, used by HashSet
+struct Identity {
+    template<class T>
+    constexpr const T &operator()(const T &value) const noexcept {
+        return value;
+    }
+};
+
+// explicit opt-in for an extractor only known at runtime; every call is an
+// indirect call through std::function
+template<class Key, class Value>
+struct RuntimeKeyOf {
+    std::function<const Key &(const Value &)> extract;
+
+    RuntimeKeyOf() = default;
+
+    RuntimeKeyOf(std::function<const Key &(const Value &)> extract) : extract(std::move(extract)) {}
+
+    const Key &operator()(const Value &value) const {
+        return extract(value);
+    }
+};
+
+// statistics policies: what a table records about itself for `stats()`
+
+// snapshot of a table's health; probe lengths count the slots (groups for
+// GroupProbing) a successful lookup of each element visits
+struct HashTableStats {
+    std::size_t size = 0;
+    std::size_t bucket_count = 0;
+    // erased slots still ending no probe sequence; always 0 for robin hood tables
+    std::size_t tombstones = 0;
+    float load_factor = 0;
+    // probe_lengths[i] is the number of elements found after i + 1 probes
+    std::vector<std::size_t> probe_lengths;
+    std::size_t longest_probe = 0;
+    double mean_probe = 0;
+    std::size_t rehash_count = 0;
+    std::chrono::nanoseconds rehash_time{0};
+};
+
+// default: records nothing, every hook is an empty inline call
+struct NoStats {
+    static constexpr bool enabled = false;
+
+    void rehash_started() noexcept {}
+
+    void rehash_finished() noexcept {}
+};
+
+// counts rehashes and the time spent in them; rehashes triggered while
+// another one is running are counted, but their time only once
+struct CollectStats {
+    static constexpr bool enabled = true;
+
+    std::size_t rehash_count = 0;
+    std::chrono::nanoseconds rehash_time{0};
+
+    void rehash_started() noexcept {
+        ++rehash_count;
+        if (depth_++ == 0) {
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    void rehash_finished() noexcept {
+        if (--depth_ == 0) {
+            rehash_time += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start_);
+        }
+    }
+
+private:
+    std::size_t depth_ = 0;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// resize policies: how a growing table moves its elements to the new arrays
+
+// default: the insert that triggers the growth rehashes every element
+struct FullRehash {
+    static constexpr std::size_t migration_step = 0;
+    static constexpr std::size_t inline_capacity = 0;
+};
+
+// growth only swaps in new arrays, cleared during the preceding inserts,
+// and keeps the old ones alive; every following insert and erase moves the
+// next `Step` old slots over, so no single operation touches the whole
+// table. `Step` must be at least 2 / max_load_factor of the collision policy
+template<std::size_t Step = 16>
+struct IncrementalRehash {
+    static_assert(Step > 0, "IncrementalRehash: at least one slot must be migrated per operation");
+    static constexpr std::size_t migration_step = Step;
+    static constexpr std::size_t inline_capacity = 0;
+};
+
+// the first `N` elements are kept inside the container object, so small
+// tables allocate nothing; the insert of element N + 1 moves them to heap
+// slots, which full rehashes grow from there on, see SmallHashTable
+template<std::size_t N = 8>
+struct InlineBuffer {
+    static_assert(N > 0, "InlineBuffer: the buffer must hold at least one element");
+    static constexpr std::size_t migration_step = 0;
+    static constexpr std::size_t inline_capacity = N;
+};
@@ -6,9 +6,159 @@
 #include <random>
 #include <utility>
 #include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <limits>
+
+// high and low halves of the full 128-bit product of a and b
+inline uint64_t mul_wide(uint64_t a, uint64_t b, uint64_t &high) {
+#if defined(__SIZEOF_INT128__)
+    __extension__ using u128 = unsigned __int128;
+    u128 product = u128(a) * b;
+    high = static_cast<uint64_t>(product >> 64);
+    return static_cast<uint64_t>(product);
+#else
+    uint64_t a_lo = a & 0xffffffffull, a_hi = a >> 32;
+    uint64_t b_lo = b & 0xffffffffull, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo, lo_hi = a_lo * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xffffffffull) + lo_hi;
+    high = a_hi * b_hi + (hi_lo >> 32) + (cross >> 32);
+    return (cross << 32) | (lo_lo & 0xffffffffull);
+#endif
+}
+
+// wyrand (Wang Yi): a 64-bit counter scrambled by one wide multiply, so the
+// whole state is 8 bytes and seeding it costs nothing; statistically sound
+// for sampling, though not cryptographic. Meets UniformRandomBitGenerator,
+// like the std engines it replaces
+class wyrand {
+public:
+    using result_type = uint64_t;
+
+    explicit wyrand(result_type seed = 0) : state(seed) {}
+
+    void seed(result_type value) {
+        state = value;
+    }
+
+    static constexpr result_type min() {
+        return 0;
+    }
+
+    static constexpr result_type max() {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    result_type operator()() {
+        state += 0xa0761d6478bd642full;
+        uint64_t high;
+        uint64_t low = mul_wide(state, state ^ 0xe7037ed1a0b428dbull, high);
+        return high ^ low;
+    }
+
+    bool operator==(const wyrand &other) const = default;
 
-template<class T, typename Container = std::vector<T>>
+private:
+    result_type state;
+};
+
+// Engine is any UniformRandomBitGenerator constructible from a seed; queues
+// are seeded from a per-thread generator unless given an engine, which makes
+// every dequeue, sample and iteration order replayable
+template<class T, typename Container = std::vector<T>, class Engine = wyrand>
 class randomized_queue {
+    // pseudo-random bijection of [0, size) picked by a 64-bit seed, so that an
+    // iteration order takes O(1) state and O(1) time a step instead of a
+    // shuffled vector of every position.
+    // It is a feistel network over the digits of a position written in base
+    // (rows, cols), with rows * cols just over size: each round adds a keyed
+    // hash of one digit to the other modulo its range and swaps their roles.
+    // After an even number of rounds a position maps to a row and a column
+    // again; the few that land past the end (under one in rows) are walked on
+    // through the network until they don't. Orders are pseudo-random rather
+    // than uniform over all permutations; tiny queues, whose digits carry too
+    // few bits to mix in six rounds, get sixteen
+    class shuffle_order {
+    public:
+        shuffle_order() = default;
+
+        shuffle_order(size_t size, uint64_t seed) : size(size), seed(seed), cols(column_count(size)),
+                                                    rows(cols == 0 ? 0 : (size + cols - 1) / cols),
+                                                    rounds(size < 256 ? 16 : 6) {}
+
+        size_t columns() const {
+            return cols;
+        }
+
+        // index visited at step row * cols + col, which is below size
+        size_t at(size_t row, size_t col) const {
+            while (true) {
+                permute(row, col);
+                size_t index = row * cols + col;
+                if (index < size) {
+                    return index;
+                }
+                row = index / cols;
+                col = index % cols;
+            }
+        }
+
+        bool operator==(const shuffle_order &other) const {
+            return size == other.size && seed == other.seed;
+        }
+
+    private:
+        void permute(size_t &row, size_t &col) const {
+            size_t left = row, right = col;
+            size_t left_range = rows, right_range = cols;
+            for (int round = 0; round < rounds; ++round) {
+                size_t sum = left + reduce(mix(right, round), left_range);
+                left = right;
+                right = sum >= left_range ? sum - left_range : sum;
+                std::swap(left_range, right_range);
+            }
+            row = left;
+            col = right;
+        }
+
+        // keyed hash of a digit, a different key every round
+        uint64_t mix(uint64_t digit, int round) const {
+            uint64_t z = (digit ^ (seed + uint64_t(round) * 0x9e3779b97f4a7c15ull)) * 0xbf58476d1ce4e5b9ull;
+            z ^= z >> 32;
+            return z * 0x94d049bb133111ebull;
+        }
+
+        // maps the high half of `hash` onto [0, range) with a multiply, range
+        // is at most 2^32
+        static size_t reduce(uint64_t hash, size_t range) {
+            return static_cast<size_t>(((hash >> 32) * range) >> 32);
+        }
+
+        // ceil(sqrt(size)), so that both digits stay below 2^32
+        static size_t column_count(size_t size) {
+            if (size == 0) {
+                return 0;
+            }
+            auto cols = static_cast<size_t>(std::sqrt(static_cast<double>(size)));
+            while (cols * cols < size) {
+                ++cols;
+            }
+            while (cols > 1 && (cols - 1) * (cols - 1) >= size) {
+                --cols;
+            }
+            return cols;
+        }
+
+        size_t size = 0;
+        uint64_t seed = 0;
+        size_t cols = 0;
+        size_t rows = 0;
+        int rounds = 0;
+    };
+
     template<class vT, class DataIt>
     struct random_iterator {
         using iterator_category = std::forward_iterator_tag;
@@ -17,34 +167,37 @@ class randomized_queue {
         using pointer = vT *;
         using reference = vT &;
 
-        random_iterator(DataIt it, std::mt19937 &rnd, size_t size) : order(size), it(it), cur_pos(0) {
-            for (size_t i = 0; i < order.size(); i++) {
-                order[i] = i;
+        random_iterator() = default;
+
+        random_iterator(DataIt it, shuffle_order order, size_t size,
+                        size_t curPos) : order(order), it(it), size(size), cur_pos(curPos) {
+            if (cur_pos < size) {
+                row = cur_pos / order.columns();
+                col = cur_pos % order.columns();
+                cur_index = order.at(row, col);
             }
-            std::shuffle(order.begin(), order.end(), rnd);
         }
 
-        random_iterator(const random_iterator &other) = default;
-
-        random_iterator(std::vector<size_t> order, DataIt &it,
-                        size_t curPos) : order(std::move(order)), it(it), cur_pos(curPos) {}
-
-
         reference operator*() const {
-            return it[order[cur_pos]];
+            return it[cur_index];
         }
 
         pointer operator->() const {
-            return &it[order[cur_pos]];
+            return &it[cur_index];
         }
 
+        // the step's digits are counted along, so a step costs no division
         random_iterator &operator++() {
-            ++cur_pos;
+            if (++cur_pos < size) {
+                if (++col == order.columns()) {
+                    col = 0;
+                    ++row;
+                }
+                cur_index = order.at(row, col);
+            }
             return *this;
         }
 
-
-
         random_iterator operator++(int) {
             auto tmp = *this;
             ++(*this);
@@ -52,7 +205,7 @@ class randomized_queue {
         }
 
         bool operator==(const random_iterator &other) const {
-            return it == other.it && cur_pos == other.cur_pos && (cur_pos == order.size() || order == other.order);
+            return it == other.it && cur_pos == other.cur_pos && (cur_pos == size || order == other.order);
         }
 
         bool operator!=(const random_iterator &other) const {
@@ -60,30 +213,174 @@ class randomized_queue {
         }
 
         operator random_iterator<const vT, typename Container::const_iterator>() const {
-            return const_iterator(order, it, cur_pos);
+            return const_iterator(it, order, size, cur_pos);
         };
 
     private:
-        friend randomized_queue<T, Container>;
-        random_iterator operator+(int shift) {
-            return random_iterator(order, it, cur_pos + shift);
+        shuffle_order order;
+        DataIt it{};
+        size_t size = 0;
+        size_t cur_pos = 0;
+        size_t row = 0;
+        size_t col = 0;
+        size_t cur_index = 0;
+    };
+
+    // every traversal gets an order of its own
+    shuffle_order next_order() const {
+        return shuffle_order(data.size(), random_bits());
+    }
+
+    // 64 uniform bits out of the engine, whatever range it produces
+    uint64_t random_bits() const {
+        constexpr auto range = Engine::max() - Engine::min();
+        if constexpr (range == std::numeric_limits<uint64_t>::max()) {
+            return static_cast<uint64_t>(rnd() - Engine::min());
+        } else if constexpr (range == std::numeric_limits<uint32_t>::max()) {
+            auto high = static_cast<uint64_t>(rnd() - Engine::min());
+            return high << 32 | static_cast<uint64_t>(rnd() - Engine::min());
+        } else {
+            return std::uniform_int_distribution<uint64_t>()(rnd);
         }
-        std::vector<size_t> order;
-        DataIt it;
-        size_t cur_pos;
+    }
+
+    // uniform index below bound (bound > 0) by Lemire's nearly divisionless
+    // method: the high half of bits * bound is the index, after rejecting the
+    // 2^64 mod bound low halves that would make some indices likelier; that
+    // remainder is only computed when a low half falls below bound, which
+    // for any realistic queue size practically never happens
+    size_t random_index(size_t bound) const {
+        uint64_t index;
+        uint64_t low = mul_wide(random_bits(), bound, index);
+        if (low < bound) {
+            uint64_t threshold = (0 - static_cast<uint64_t>(bound)) % bound;
+            while (low < threshold) {
+                low = mul_wide(random_bits(), bound, index);
+            }
+        }
+        return static_cast<size_t>(index);
+    }
+
+    // indices of `count` Fisher-Yates steps over [0, bound), [0, bound - 1), ...
+    // handed to step one by one.
+    // Engines narrower than 64 bits take several calls for every random_bits(),
+    // so their steps share draws instead (batched ranged integers,
+    // Brackett-Rozinsky and Lemire): as many consecutive bounds as fit their
+    // bits into 64 read one draw as a mixed-radix number, each taking the high
+    // half of its product with what the previous ones left, and the draw is
+    // rejected as a whole, the way random_index rejects for a single bound.
+    // A 64-bit engine like wyrand is cheaper to call than that bookkeeping
+    template<class Step>
+    void for_each_index(size_t bound, size_t count, Step &&step) const {
+        if constexpr (Engine::max() - Engine::min() == std::numeric_limits<uint64_t>::max()) {
+            for (; count != 0; --count, --bound) {
+                step(random_index(bound));
+            }
+        } else {
+            size_t indices[4];
+            while (count != 0) {
+                int bits = std::bit_width(bound);
+                size_t batch = std::min<size_t>(count, bits <= 16 ? 4 : bits <= 21 ? 3 : bits <= 32 ? 2 : 1);
+                uint64_t product = bound;
+                for (size_t i = 1; i < batch; ++i) {
+                    product *= bound - i;
+                }
+                while (true) {
+                    uint64_t left = random_bits();
+                    for (size_t i = 0; i < batch; ++i) {
+                        uint64_t index;
+                        left = mul_wide(left, bound - i, index);
+                        indices[i] = static_cast<size_t>(index);
+                    }
+                    if (left >= product || left >= (0 - product) % product) {
+                        break;
+                    }
+                }
+                for (size_t i = 0; i < batch; ++i) {
+                    step(indices[i]);
+                }
+                bound -= batch;
+                count -= batch;
+            }
+        }
+    }
+
+    // positions of a partial Fisher-Yates pass that sample_n runs without
+    // touching the elements: only the positions a step has overwritten are
+    // stored, in an open-addressed table twice as large as the sample
+    class sparse_positions {
+    public:
+        sparse_positions(size_t count, const typename Container::allocator_type &alloc) : entries(
+                std::bit_ceil(std::max<size_t>(2 * count, 8)), entry{empty, 0}, alloc), mask(entries.size() - 1) {}
+
+        // the position currently at `pos`, which then receives `taken`'s
+        size_t exchange(size_t pos, size_t taken) {
+            size_t current = get(taken);
+            size_t i = pos & mask;
+            while (entries[i].pos != empty && entries[i].pos != pos) {
+                i = (i + 1) & mask;
+            }
+            size_t result = entries[i].pos == empty ? pos : entries[i].value;
+            entries[i] = entry{pos, current};
+            return result;
+        }
+
+    private:
+        static constexpr size_t empty = std::numeric_limits<size_t>::max();
+
+        struct entry {
+            size_t pos;
+            size_t value;
+        };
+
+        size_t get(size_t pos) const {
+            for (size_t i = pos & mask; entries[i].pos != empty; i = (i + 1) & mask) {
+                if (entries[i].pos == pos) {
+                    return entries[i].value;
+                }
+            }
+            return pos;
+        }
+
+        std::vector<entry, typename std::allocator_traits<
+                typename Container::allocator_type>::template rebind_alloc<entry>> entries;
+        size_t mask;
     };
 
+    // seeds of queues built without an engine; random_device is read once
+    // per thread instead of once per queue
+    static typename Engine::result_type fresh_seed() {
+        thread_local wyrand seeds([] {
+            std::random_device device;
+            return uint64_t(device()) << 32 | device();
+        }());
+        return static_cast<typename Engine::result_type>(seeds());
+    }
+
 public:
     using container_type = Container;
     using value_type = typename Container::value_type;
     using size_type = typename Container::size_type;
     using reference = typename Container::reference;
     using const_reference = typename Container::const_reference;
+    using allocator_type = typename Container::allocator_type;
     using iterator = random_iterator<T, typename Container::iterator>;
     using const_iterator = random_iterator<const T, typename Container::const_iterator>;
 
+    using engine_type = Engine;
+
     randomized_queue() = default;
 
+    explicit randomized_queue(const allocator_type &alloc) : data(alloc) {}
+
+    // e.g. randomized_queue<int>(wyrand(seed)) for a reproducible run
+    explicit randomized_queue(const engine_type &engine,
+                              const allocator_type &alloc = allocator_type()) : data(alloc), rnd(engine) {}
+
+    allocator_type get_allocator() const {
+        return data.get_allocator();
+    }
+
     bool empty() const {
         return data.empty();
     }
@@ -92,6 +389,11 @@ public:
         return data.size();
     }
 
+    // restarts the queue's random sequence, as engine_type(value) would
+    void seed(typename engine_type::result_type value) {
+        rnd.seed(value);
+    }
+
     void enqueue(T &item) {
         data.emplace_back(item);
     }
@@ -101,41 +403,91 @@ public:
     }
 
     T const &sample() const {
-        return data[rnd() % data.size()];
+        return data[random_index(data.size())];
     }
 
     T dequeue() {
-        std::swap(data[rnd() % data.size()], data[data.size() - 1]);
+        std::swap(data[random_index(data.size())], data[data.size() - 1]);
         auto res = std::move(data.back());
         data.pop_back();
         return res;
     }
 
+    // moves min(k, size()) distinct random elements to out in random order,
+    // as that many dequeue() calls would, but in one partial Fisher-Yates
+    // pass: every element is moved once into out and the back element once
+    // into its place, and the tail is popped at the end
+    template<class OutputIt>
+    OutputIt dequeue_n(size_t k, OutputIt out) {
+        k = std::min(k, data.size());
+        size_t last = data.size();
+        try {
+            for_each_index(data.size(), k, [&](size_t index) {
+                // `last` moves only once the element is out and the back
+                // one in its place: if either throws, the catch below
+                // erases only elements that really left
+                size_t back = last - 1;
+                *out = std::move(data[index]);
+                ++out;
+                if (index != back) {
+                    data[index] = std::move(data[back]);
+                }
+                last = back;
+            });
+        } catch (...) {
+            data.erase(data.begin() + static_cast<std::ptrdiff_t>(last), data.end());
+            throw;
+        }
+        data.erase(data.begin() + static_cast<std::ptrdiff_t>(last), data.end());
+        return out;
+    }
+
+    // copies min(k, size()) distinct random elements to out in random order,
+    // leaving the queue as it is; takes O(k) time and memory whatever the size
+    template<class OutputIt>
+    OutputIt sample_n(size_t k, OutputIt out) const {
+        k = std::min(k, data.size());
+        sparse_positions positions(k, data.get_allocator());
+        size_t last = data.size();
+        for_each_index(data.size(), k, [&](size_t index) {
+            *out = data[positions.exchange(index, --last)];
+            ++out;
+        });
+        return out;
+    }
+
     iterator begin() {
-        return iterator(data.begin(), rnd, data.size());
+        return iterator(data.begin(), next_order(), data.size(), 0);
     }
 
     const_iterator begin() const {
-        return const_iterator(data.begin(), rnd, data.size());
+        return const_iterator(data.begin(), next_order(), data.size(), 0);
     }
 
+    // the end is the same for every order, so it is not shuffled at all
     iterator end() {
-        return iterator(data.begin(), rnd, data.size()) + data.size();
+        return iterator(data.begin(), shuffle_order(), data.size(), data.size());
     }
 
     const_iterator end() const {
-        return const_iterator(data.begin(), rnd, data.size()) + data.size();
+        return const_iterator(data.begin(), shuffle_order(), data.size(), data.size());
     }
 
     const_iterator cbegin() const {
-        return const_iterator(data.cbegin(), rnd, data.size());
+        return begin();
     }
 
     const_iterator cend() const {
-        return const_iterator(data.begin(), rnd, data.size()) + data.size();
+        return end();
     }
 
 private:
     Container data;
-    mutable std::mt19937 rnd = std::mt19937(std::random_device()());
+    mutable Engine rnd = Engine(fresh_seed());
 };
+
+namespace pmr {
+// randomized_queue allocating from a std::pmr::memory_resource
+template<class T, class Engine = wyrand>
+using randomized_queue = ::randomized_queue<T, std::pmr::vector<T>, Engine>;
+}
@@ -0,0 +1,632 @@
+#pragma once
+
+#include "policy.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// HashMap for integer (or enum) keys where two key values are never used:
+// `EmptyKey` marks never used slots and `DeletedKey` erased ones, so the
+// table is a single array of `std::pair<const Key, T>` with no control bytes
+// and lookups are a plain loop of integer compares; misses walk whole slots
+// rather than HashMap's control bytes, so tables probed mostly for absent
+// keys are better off as a HashMap. The two reserved keys themselves can't
+// be inserted (std::invalid_argument) and are never found.
+// Only the probe sequences of LinearProbing and QuadraticProbing fit a table
+// without control bytes; mapped values must be nothrow default constructible
+// and nothrow movable, every free slot holds a default constructed one.
+// Covers the core of HashMap's interface only: no node handles, merge,
+// batches, statistics or saving
+template<
+        class Key,
+        class T,
+        Key EmptyKey,
+        Key DeletedKey,
+        class CollisionPolicy = LinearProbing,
+        class Hash = std::hash<Key>,
+        class IndexPolicy = PowerOfTwoMasking,
+        class Allocator = std::allocator<std::pair<const Key, T>>
+>
+class SentinelHashMap {
+    static_assert(std::is_integral_v<Key> || std::is_enum_v<Key>, "SentinelHashMap: keys must be integers or enums");
+    static_assert(EmptyKey != DeletedKey, "SentinelHashMap: empty and deleted keys must differ");
+    static_assert(!requires { CollisionPolicy::robin_hood; } && !requires { CollisionPolicy::group_width; },
+                  "SentinelHashMap: robin hood and group probing need control bytes");
+    static_assert(std::is_nothrow_default_constructible_v<T> && std::is_nothrow_move_constructible_v<T>,
+                  "SentinelHashMap: mapped values must be nothrow default constructible and movable");
+
+    template<class V>
+    class SentinelIterator;
+
+public:
+    // types
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<const Key, T>;
+    using hasher = Hash;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using allocator_type = Allocator;
+    using reference = value_type &;
+    using const_reference = const value_type &;
+    using pointer = value_type *;
+    using const_pointer = const value_type *;
+
+    using iterator = SentinelIterator<value_type>;
+    using const_iterator = SentinelIterator<const value_type>;
+
+private:
+    using alloc_traits = std::allocator_traits<Allocator>;
+
+    template<class V>
+    class SentinelIterator {
+    private:
+        V *slot_;
+        V *end_;
+
+        friend SentinelHashMap;
+        template<class>
+        friend class SentinelIterator;
+
+        SentinelIterator(V *slot, V *end) : slot_(slot), end_(end) {
+            skip();
+        }
+
+        void skip() {
+            while (slot_ != end_ && is_reserved(slot_->first)) {
+                ++slot_;
+            }
+        }
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::remove_const_t<V>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = V *;
+        using reference = V &;
+
+        SentinelIterator() : slot_(nullptr), end_(nullptr) {}
+
+        operator SentinelIterator<const V>() const requires (!std::is_const_v<V>) {
+            return SentinelIterator<const V>(slot_, end_);
+        }
+
+        reference operator*() const {
+            return *slot_;
+        }
+
+        pointer operator->() const {
+            return slot_;
+        }
+
+        SentinelIterator &operator++() {
+            ++slot_;
+            skip();
+            return *this;
+        }
+
+        SentinelIterator operator++(int) {
+            SentinelIterator res = *this;
+            ++*this;
+            return res;
+        }
+
+        friend bool operator==(const SentinelIterator &lhs, const SentinelIterator &rhs) {
+            return lhs.slot_ == rhs.slot_;
+        }
+    };
+
+public:
+    explicit SentinelHashMap(size_type expected_max_size = 4,
+                             const hasher &hash = hasher(),
+                             const allocator_type &alloc = allocator_type()) : hash_(hash), alloc_(alloc) {
+        allocate(capacity_for(expected_max_size));
+    }
+
+    explicit SentinelHashMap(const allocator_type &alloc) : SentinelHashMap(4, hasher(), alloc) {}
+
+    template<class InputIt>
+    SentinelHashMap(InputIt first, InputIt last,
+                    size_type expected_max_size = 4,
+                    const hasher &hash = hasher(),
+                    const allocator_type &alloc = allocator_type()) : SentinelHashMap(expected_max_size, hash, alloc) {
+        insert(first, last);
+    }
+
+    SentinelHashMap(std::initializer_list<value_type> init,
+                    size_type expected_max_size = 4,
+                    const hasher &hash = hasher(),
+                    const allocator_type &alloc = allocator_type()) : SentinelHashMap(init.begin(), init.end(),
+                                                                                      std::max(expected_max_size,
+                                                                                               init.size()),
+                                                                                      hash, alloc) {}
+
+    // copies the slot array as is, tombstones included
+    SentinelHashMap(const SentinelHashMap &o) : hash_(o.hash_),
+                                                alloc_(alloc_traits::select_on_container_copy_construction(o.alloc_)),
+                                                max_load_factor_(o.max_load_factor_) {
+        slots_ = alloc_traits::allocate(alloc_, o.count_);
+        size_type i = 0;
+        try {
+            for (; i < o.count_; ++i) {
+                alloc_traits::construct(alloc_, slots_ + i, o.slots_[i]);
+            }
+        } catch (...) {
+            destroy_slots(slots_, i);
+            alloc_traits::deallocate(alloc_, slots_, o.count_);
+            throw;
+        }
+        count_ = o.count_;
+        size_ = o.size_;
+        used_ = o.used_;
+    }
+
+    // leaves `o` without slots; it can still be assigned to or inserted into
+    SentinelHashMap(SentinelHashMap &&o) noexcept: hash_(std::move(o.hash_)), alloc_(std::move(o.alloc_)),
+                                                   slots_(std::exchange(o.slots_, nullptr)),
+                                                   count_(std::exchange(o.count_, 0)),
+                                                   size_(std::exchange(o.size_, 0)),
+                                                   used_(std::exchange(o.used_, 0)),
+                                                   max_load_factor_(o.max_load_factor_) {}
+
+    SentinelHashMap &operator=(const SentinelHashMap &other) {
+        if (this != &other) {
+            swap(SentinelHashMap(other));
+        }
+        return *this;
+    }
+
+    SentinelHashMap &operator=(SentinelHashMap &&other) noexcept {
+        swap(std::move(other));
+        return *this;
+    }
+
+    SentinelHashMap &operator=(std::initializer_list<value_type> init) {
+        swap(SentinelHashMap(init));
+        return *this;
+    }
+
+    ~SentinelHashMap() {
+        release();
+    }
+
+    // the allocators are exchanged only if they propagate on swap,
+    // otherwise they must be equal
+    void swap(SentinelHashMap &other) noexcept {
+        using std::swap;
+        swap(hash_, other.hash_);
+        if constexpr (alloc_traits::propagate_on_container_swap::value) {
+            swap(alloc_, other.alloc_);
+        }
+        swap(slots_, other.slots_);
+        swap(count_, other.count_);
+        swap(size_, other.size_);
+        swap(used_, other.used_);
+        swap(max_load_factor_, other.max_load_factor_);
+    }
+
+    void swap(SentinelHashMap &&other) noexcept {
+        swap(other);
+    }
+
+    friend void swap(SentinelHashMap &lhs, SentinelHashMap &rhs) noexcept {
+        lhs.swap(rhs);
+    }
+
+    iterator begin() noexcept {
+        return iterator(slots_, slots_ + count_);
+    }
+
+    const_iterator begin() const noexcept {
+        return const_iterator(slots_, slots_ + count_);
+    }
+
+    const_iterator cbegin() const noexcept {
+        return begin();
+    }
+
+    iterator end() noexcept {
+        return iterator(slots_ + count_, slots_ + count_);
+    }
+
+    const_iterator end() const noexcept {
+        return const_iterator(slots_ + count_, slots_ + count_);
+    }
+
+    const_iterator cend() const noexcept {
+        return end();
+    }
+
+    bool empty() const noexcept {
+        return size_ == 0;
+    }
+
+    size_type size() const noexcept {
+        return size_;
+    }
+
+    size_type bucket_count() const noexcept {
+        return count_;
+    }
+
+    float load_factor() const {
+        return count_ == 0 ? 0 : static_cast<float>(size_) / count_;
+    }
+
+    float max_load_factor() const {
+        return max_load_factor_;
+    }
+
+    // see HashTable::max_load_factor
+    void max_load_factor(float ml) {
+        if (!(ml > 0 && ml < 1)) {
+            throw std::invalid_argument("SentinelHashMap: max_load_factor must be in (0, 1)");
+        }
+        max_load_factor_ = ml;
+        if (used_ > max_load_factor_ * count_) {
+            rehash_to(capacity_for(size_));
+        }
+    }
+
+    allocator_type get_allocator() const {
+        return alloc_;
+    }
+
+    hasher hash_function() const {
+        return hash_;
+    }
+
+    iterator find(const key_type &key) {
+        return iterator(slots_ + find_index(key), slots_ + count_);
+    }
+
+    const_iterator find(const key_type &key) const {
+        return const_iterator(slots_ + find_index(key), slots_ + count_);
+    }
+
+    bool contains(const key_type &key) const {
+        return find_index(key) != count_;
+    }
+
+    size_type count(const key_type &key) const {
+        return contains(key);
+    }
+
+    std::pair<iterator, iterator> equal_range(const key_type &key) {
+        iterator it = find(key);
+        return {it, it == end() ? it : std::next(it)};
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(const key_type &key) const {
+        const_iterator it = find(key);
+        return {it, it == end() ? it : std::next(it)};
+    }
+
+    T &at(const key_type &key) {
+        size_type id = find_index(key);
+        if (id == count_) {
+            throw std::out_of_range("SentinelHashMap: no such key");
+        }
+        return slots_[id].second;
+    }
+
+    const T &at(const key_type &key) const {
+        size_type id = find_index(key);
+        if (id == count_) {
+            throw std::out_of_range("SentinelHashMap: no such key");
+        }
+        return slots_[id].second;
+    }
+
+    T &operator[](const key_type &key) {
+        return try_emplace(key).first->second;
+    }
+
+    template<class... Args>
+    std::pair<iterator, bool> try_emplace(const key_type &key, Args &&... args) {
+        check_key(key);
+        auto [id, found] = prepare_insert(key);
+        if (!found) {
+            fill(id, std::piecewise_construct, std::forward_as_tuple(key),
+                 std::forward_as_tuple(std::forward<Args>(args)...));
+        }
+        return {iterator(slots_ + id, slots_ + count_), !found};
+    }
+
+    template<class... Args>
+    iterator try_emplace(const_iterator, const key_type &key, Args &&... args) {
+        return try_emplace(key, std::forward<Args>(args)...).first;
+    }
+
+    template<class... Args>
+    std::pair<iterator, bool> emplace(Args &&... args) {
+        value_type value(std::forward<Args>(args)...);
+        return try_emplace(value.first, std::move(value.second));
+    }
+
+    std::pair<iterator, bool> insert(const value_type &value) {
+        return try_emplace(value.first, value.second);
+    }
+
+    std::pair<iterator, bool> insert(value_type &&value) {
+        return try_emplace(value.first, std::move(value.second));
+    }
+
+    template<class InputIt>
+    void insert(InputIt first, InputIt last) {
+        for (; first != last; ++first) {
+            insert(*first);
+        }
+    }
+
+    void insert(std::initializer_list<value_type> init) {
+        insert(init.begin(), init.end());
+    }
+
+    template<class M>
+    std::pair<iterator, bool> insert_or_assign(const key_type &key, M &&value) {
+        std::pair<iterator, bool> res = try_emplace(key, std::forward<M>(value));
+        if (!res.second) {
+            res.first->second = std::forward<M>(value);
+        }
+        return res;
+    }
+
+    iterator erase(const_iterator pos) {
+        size_type id = pos.slot_ - slots_;
+        erase_at(id);
+        return iterator(slots_ + id + 1, slots_ + count_);
+    }
+
+    iterator erase(const_iterator first, const_iterator last) {
+        while (first != last) {
+            first = erase(first);
+        }
+        return iterator(const_cast<value_type *>(last.slot_), slots_ + count_);
+    }
+
+    size_type erase(const key_type &key) {
+        size_type id = find_index(key);
+        if (id == count_) {
+            return 0;
+        }
+        erase_at(id);
+        return 1;
+    }
+
+    // keeps the slot array
+    void clear() noexcept {
+        for (size_type i = 0; i < count_; ++i) {
+            if (slots_[i].first != EmptyKey) {
+                reset(i, EmptyKey);
+            }
+        }
+        size_ = 0;
+        used_ = 0;
+    }
+
+    void rehash(size_type count) {
+        rehash_to(std::max(capacity_for_buckets(count), capacity_for(size_)));
+    }
+
+    void reserve(size_type count) {
+        if (capacity_for(count) > count_) {
+            rehash_to(capacity_for(count));
+        }
+    }
+
+    // calls `pred(value_type &)` on every element in one sweep over the
+    // slot array, erasing those it returns true for
+    template<class Pred>
+    friend size_type erase_if(SentinelHashMap &map, Pred pred) {
+        size_type erased = 0;
+        for (size_type i = 0; i < map.count_; ++i) {
+            if (!is_reserved(map.slots_[i].first) && pred(map.slots_[i])) {
+                map.erase_at(i);
+                ++erased;
+            }
+        }
+        return erased;
+    }
+
+    // same keys mapped to equal values
+    friend bool operator==(const SentinelHashMap &lhs, const SentinelHashMap &rhs) {
+        if (lhs.size_ != rhs.size_) {
+            return false;
+        }
+        for (const value_type &value: lhs) {
+            size_type id = rhs.find_index(value.first);
+            if (id == rhs.count_ || !(rhs.slots_[id].second == value.second)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    static constexpr size_type min_bucket_count_ = 8;
+    static constexpr bool linear_ = std::is_same_v<CollisionPolicy, LinearProbing>;
+
+    static bool is_reserved(const key_type &key) {
+        return (key == EmptyKey) | (key == DeletedKey);
+    }
+
+    static void check_key(const key_type &key) {
+        if (is_reserved(key)) {
+            throw std::invalid_argument("SentinelHashMap: key is reserved for empty or deleted slots");
+        }
+    }
+
+    size_type hash_of(const key_type &key) const {
+        if constexpr (is_avalanching_v<hasher> || IndexPolicy::self_mixing) {
+            return hash_(key);
+        } else {
+            return mix_hash(hash_(key));
+        }
+    }
+
+    // slot of `key`, or count_; the load factor keeps an empty slot on every
+    // probe sequence, so the loop needs no bound
+    size_type find_index(const key_type &key) const {
+        if (count_ == 0) {
+            return count_;
+        }
+        for (CollisionPolicy it(count_, IndexPolicy::home(hash_of(key), count_));; ++it) {
+            const key_type &k = slots_[*it].first;
+            // a reserved key matches a free slot or a tombstone
+            if (k == key) {
+                return is_reserved(key) ? count_ : *it;
+            }
+            if (k == EmptyKey) {
+                return count_;
+            }
+        }
+    }
+
+    // slot of `key` if it is there, otherwise a free slot to put it in (the
+    // first tombstone on its probe sequence if any); grows the table first
+    // if a new element wouldn't fit
+    std::pair<size_type, bool> prepare_insert(const key_type &key) {
+        if (used_ + 1 > max_load_factor_ * count_) {
+            size_type id = find_index(key);
+            if (id != count_) {
+                return {id, true};
+            }
+            grow();
+        }
+        size_type tombstone = count_;
+        for (CollisionPolicy it(count_, IndexPolicy::home(hash_of(key), count_));; ++it) {
+            const key_type &k = slots_[*it].first;
+            if (k == key) {
+                return {*it, true};
+            }
+            if (k == EmptyKey) {
+                return {tombstone != count_ ? tombstone : *it, false};
+            }
+            if (k == DeletedKey && tombstone == count_) {
+                tombstone = *it;
+            }
+        }
+    }
+
+    // builds the element in free slot `id`; the slot's placeholder is only
+    // replaced once the element is built
+    template<class... Args>
+    void fill(size_type id, Args &&... args) {
+        value_type value(std::forward<Args>(args)...);
+        if (slots_[id].first == EmptyKey) {
+            ++used_;
+        }
+        alloc_traits::destroy(alloc_, slots_ + id);
+        alloc_traits::construct(alloc_, slots_ + id, std::move(value));
+        ++size_;
+    }
+
+    void reset(size_type id, key_type mark) noexcept {
+        alloc_traits::destroy(alloc_, slots_ + id);
+        alloc_traits::construct(alloc_, slots_ + id, std::piecewise_construct, std::forward_as_tuple(mark),
+                                std::forward_as_tuple());
+    }
+
+    void erase_at(size_type id) noexcept {
+        --size_;
+        // under linear probing a slot followed by an empty one ends no probe
+        // sequence, and neither do the tombstones right before it
+        if constexpr (linear_) {
+            if (slots_[(id + 1) & (count_ - 1)].first == EmptyKey) {
+                reset(id, EmptyKey);
+                --used_;
+                for (size_type i = (id - 1) & (count_ - 1); slots_[i].first == DeletedKey; i = (i - 1) & (count_ - 1)) {
+                    reset(i, EmptyKey);
+                    --used_;
+                }
+                return;
+            }
+        }
+        reset(id, DeletedKey);
+    }
+
+    static size_type capacity_for_buckets(size_type count) {
+        return std::max(min_bucket_count_, std::bit_ceil(std::max<size_type>(count, 1)));
+    }
+
+    size_type capacity_for(size_type expected_max_size) const {
+        return capacity_for_buckets(static_cast<size_type>(std::ceil(expected_max_size / max_load_factor_)));
+    }
+
+    // rebuilds in place if the table is mostly tombstones, otherwise doubles it
+    void grow() {
+        if (size_ + 1 > max_load_factor_ * count_ / 2) {
+            rehash_to(capacity_for_buckets(count_ * 2));
+        } else {
+            rehash_to(capacity_for_buckets(count_));
+        }
+    }
+
+    void allocate(size_type count) {
+        slots_ = alloc_traits::allocate(alloc_, count);
+        for (size_type i = 0; i < count; ++i) {
+            alloc_traits::construct(alloc_, slots_ + i, std::piecewise_construct, std::forward_as_tuple(EmptyKey),
+                                    std::forward_as_tuple());
+        }
+        count_ = count;
+        size_ = 0;
+        used_ = 0;
+    }
+
+    // elements are moved into a new array; nothing there can throw but the
+    // allocation, which leaves the table as it was
+    void rehash_to(size_type count) {
+        value_type *old = slots_;
+        size_type old_count = count_;
+        allocate(count);
+        for (size_type i = 0; i < old_count; ++i) {
+            if (!is_reserved(old[i].first)) {
+                size_type id = prepare_insert(old[i].first).first;
+                fill(id, std::move(old[i]));
+            }
+        }
+        free_slots(old, old_count);
+    }
+
+    void destroy_slots(value_type *slots, size_type count) noexcept {
+        if constexpr (!std::is_trivially_destructible_v<value_type>) {
+            for (size_type i = 0; i < count; ++i) {
+                alloc_traits::destroy(alloc_, slots + i);
+            }
+        }
+    }
+
+    void free_slots(value_type *slots, size_type count) noexcept {
+        if (slots != nullptr) {
+            destroy_slots(slots, count);
+            alloc_traits::deallocate(alloc_, slots, count);
+        }
+    }
+
+    void release() noexcept {
+        free_slots(slots_, count_);
+        slots_ = nullptr;
+        count_ = 0;
+        size_ = 0;
+        used_ = 0;
+    }
+
+    [[no_unique_address]] hasher hash_;
+    [[no_unique_address]] allocator_type alloc_;
+    value_type *slots_ = nullptr;
+    size_type count_ = 0;
+    size_type size_ = 0;
+    // elements and tombstones
+    size_type used_ = 0;
+    float max_load_factor_ = 0.5;
+};
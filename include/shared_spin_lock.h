@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+// reader-writer spinlock for short critical sections: readers share it
+// through a counter, a writer owns it with the top bit; a waiting writer
+// sets the pending bit, which keeps new readers out so it isn't starved
+class SharedSpinLock {
+private:
+    static constexpr std::uint32_t writer_ = 1u << 31;
+    static constexpr std::uint32_t pending_ = 1u << 30;
+    static constexpr int spins_before_yield_ = 64;
+
+    std::atomic<std::uint32_t> state_{0};
+
+    static void relax(int &spins) {
+        if (++spins < spins_before_yield_) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+            __builtin_ia32_pause();
+#endif
+        } else {
+            spins = 0;
+            std::this_thread::yield();
+        }
+    }
+
+public:
+    SharedSpinLock() = default;
+
+    SharedSpinLock(const SharedSpinLock &) = delete;
+
+    SharedSpinLock &operator=(const SharedSpinLock &) = delete;
+
+    bool try_lock() noexcept {
+        std::uint32_t state = state_.load(std::memory_order_relaxed);
+        return (state & ~pending_) == 0 &&
+               state_.compare_exchange_strong(state, writer_, std::memory_order_acquire);
+    }
+
+    void lock() noexcept {
+        for (int spins = 0; !try_lock(); relax(spins)) {
+            if (!(state_.load(std::memory_order_relaxed) & pending_)) {
+                state_.fetch_or(pending_, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // other waiting writers set the pending bit again on their next try
+    void unlock() noexcept {
+        state_.store(0, std::memory_order_release);
+    }
+
+    bool try_lock_shared() noexcept {
+        std::uint32_t state = state_.load(std::memory_order_relaxed);
+        return !(state & (writer_ | pending_)) &&
+               state_.compare_exchange_strong(state, state + 1, std::memory_order_acquire);
+    }
+
+    void lock_shared() noexcept {
+        for (int spins = 0; !try_lock_shared(); relax(spins)) {}
+    }
+
+    void unlock_shared() noexcept {
+        state_.fetch_sub(1, std::memory_order_release);
+    }
+};
@@ -0,0 +1,949 @@
+#pragma once
+
+#include "policy.h"
+#include "group.h"
+#include "hash_table.h"
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+
+// HashTable whose first `N` elements live in the table object itself: an
+// empty one allocates nothing, and up to `N` elements sit in an inline
+// buffer with a control byte each, looked up by matching the hash fragment
+// against all of those bytes at once (see Group) instead of by probing.
+// Inserting element N + 1 moves them all into the heap slots of a regular
+// table, which is kept until clear(). Inline elements travel with the
+// object, so moving or swapping it invalidates iterators into the buffer
+template<
+        class Key,
+        class Value,
+        class KeyOf,
+        class CollisionPolicy,
+        class Hash,
+        class Equal,
+        class Storage,
+        class IndexPolicy,
+        class StatsPolicy,
+        class Allocator,
+        std::size_t N
+>
+class SmallHashTable {
+private:
+    using Table = HashTable<Key, Value, KeyOf, CollisionPolicy, Hash, Equal, Storage, IndexPolicy, StatsPolicy,
+            Allocator>;
+    using slot_type = typename Table::slot_type;
+    using element_allocator = typename Table::element_allocator;
+    using alloc_traits = std::allocator_traits<Allocator>;
+
+    // moving or swapping a table moves its inline elements one by one, which
+    // may throw for map values, whose const keys are copied
+    static constexpr bool nothrow_relocate_ = noexcept(std::declval<slot_type &>().relocate(
+            std::declval<element_allocator &>(), std::declval<slot_type &>()));
+public:
+    using key_type = Key;
+    using value_type = Value;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using hasher = Hash;
+    using key_equal = Equal;
+    using allocator_type = Allocator;
+    using reference = value_type &;
+    using const_reference = const value_type &;
+    using pointer = value_type *;
+    using const_pointer = const value_type *;
+
+    using iterator = typename Table::iterator;
+    using const_iterator = typename Table::const_iterator;
+    using node_type = typename Table::node_type;
+    using insert_return_type = typename Table::insert_return_type;
+
+    static constexpr bool transparent_lookup = Table::transparent_lookup;
+
+    static_assert(N > 0, "SmallHashTable: the inline buffer must hold at least one element");
+
+    explicit SmallHashTable(size_type expected_max_size = 1,
+                            const hasher &hash = hasher(),
+                            const key_equal &equal = key_equal(),
+                            const KeyOf &key_of = KeyOf(),
+                            const allocator_type &alloc = allocator_type()) : table_(typename Table::no_slots_t(),
+                                                                                     hash, equal, key_of, alloc) {
+        if (expected_max_size > N) {
+            table_.allocate(table_.capacity_for(expected_max_size));
+        }
+    }
+
+    explicit SmallHashTable(const allocator_type &alloc) : SmallHashTable(1, hasher(), key_equal(), KeyOf(),
+                                                                          alloc) {}
+
+    template<class InputIt>
+    SmallHashTable(InputIt first, InputIt last,
+                   size_type expected_max_size = 1,
+                   const hasher &hash = hasher(),
+                   const key_equal &equal = key_equal(),
+                   const KeyOf &key_of = KeyOf(),
+                   const allocator_type &alloc = allocator_type()) : SmallHashTable(expected_max_size, hash, equal,
+                                                                                    key_of, alloc) {
+        insert(first, last);
+    }
+
+    SmallHashTable(std::initializer_list<value_type> init,
+                   size_type expected_max_size = 1,
+                   const hasher &hash = hasher(),
+                   const key_equal &equal = key_equal(),
+                   const KeyOf &key_of = KeyOf(),
+                   const allocator_type &alloc = allocator_type()) : SmallHashTable(
+            std::max(expected_max_size, init.size()), hash, equal, key_of, alloc) {
+        insert(init);
+    }
+
+    SmallHashTable(const SmallHashTable &o) : SmallHashTable(o, alloc_traits::select_on_container_copy_construction(
+            o.get_allocator())) {}
+
+    SmallHashTable(const SmallHashTable &o, const allocator_type &alloc) : table_(
+            o.spilled() ? Table(o.table_, alloc) : Table(typename Table::no_slots_t(), o.table_.hash_,
+                                                         o.table_.equal_, o.table_.key_of_, alloc)) {
+        table_.max_load_factor_ = o.table_.max_load_factor_;
+        try {
+            for (size_type i = 0; i < N; ++i) {
+                if (is_full(o.ctrl_[i])) {
+                    slots_[i].construct(table_.alloc_, *o.slots_[i].get());
+                    occupy(i, o.ctrl_[i], o.slots_[i]);
+                }
+            }
+        } catch (...) {
+            destroy_inline();
+            throw;
+        }
+    }
+
+    // a node pool goes along with the table, so inline nodes just change hands
+    SmallHashTable(SmallHashTable &&o) noexcept(nothrow_relocate_) : table_(std::move(o.table_)) {
+        if constexpr (nothrow_relocate_) {
+            move_inline(o, *this);
+        } else {
+            try {
+                move_inline(o, *this);
+            } catch (...) {
+                destroy_inline();
+                throw;
+            }
+        }
+    }
+
+    // steals `o`'s slots or inline elements if its allocator equals `alloc`,
+    // otherwise moves its elements one by one into memory from `alloc`
+    SmallHashTable(SmallHashTable &&o, const allocator_type &alloc) : table_(
+            o.spilled() ? Table(std::move(o.table_), alloc) : Table(typename Table::no_slots_t(), o.table_.hash_,
+                                                                    o.table_.equal_, o.table_.key_of_, alloc)) {
+        table_.max_load_factor_ = o.table_.max_load_factor_;
+        try {
+            for (size_type i = 0; i < N; ++i) {
+                if (is_full(o.ctrl_[i])) {
+                    adopt(o, i, slots_[i]);
+                    occupy(i, o.ctrl_[i], o.slots_[i]);
+                    o.free_at(i);
+                }
+            }
+        } catch (...) {
+            destroy_inline();
+            throw;
+        }
+    }
+
+    ~SmallHashTable() {
+        destroy_inline();
+    }
+
+    // the allocator of this table is kept unless it propagates on copy/move
+    // assignment, like the std containers do
+    SmallHashTable &operator=(const SmallHashTable &other) {
+        if (this != &other) {
+            SmallHashTable tmp(other, alloc_traits::propagate_on_container_copy_assignment::value
+                                      ? other.get_allocator() : get_allocator());
+            swap(std::move(tmp));
+        }
+        return *this;
+    }
+
+    SmallHashTable &operator=(SmallHashTable &&other) noexcept(nothrow_relocate_ && (
+            alloc_traits::propagate_on_container_move_assignment::value || alloc_traits::is_always_equal::value)) {
+        if constexpr (alloc_traits::propagate_on_container_move_assignment::value ||
+                      alloc_traits::is_always_equal::value) {
+            swap(std::move(other));
+        } else {
+            SmallHashTable tmp(std::move(other), get_allocator());
+            swap(std::move(tmp));
+        }
+        return *this;
+    }
+
+    SmallHashTable &operator=(std::initializer_list<value_type> init) {
+        clear();
+        insert(init);
+        return *this;
+    }
+
+    iterator begin() noexcept {
+        return spilled() ? table_.begin() : inline_from(0);
+    }
+
+    const_iterator begin() const noexcept {
+        return spilled() ? table_.begin() : inline_from(0);
+    }
+
+    const_iterator cbegin() const noexcept {
+        return begin();
+    }
+
+    iterator end() noexcept {
+        return spilled() ? table_.end() : inline_at(N);
+    }
+
+    const_iterator end() const noexcept {
+        return spilled() ? table_.end() : inline_at(N);
+    }
+
+    const_iterator cend() const noexcept {
+        return end();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_type size() const {
+        return spilled() ? table_.size() : size_;
+    }
+
+    size_type max_size() const {
+        return table_.max_size();
+    }
+
+    allocator_type get_allocator() const {
+        return table_.get_allocator();
+    }
+
+    hasher hash_function() const {
+        return table_.hash_function();
+    }
+
+    key_equal key_eq() const {
+        return table_.key_eq();
+    }
+
+    // also frees the heap slots, the elements that come next start inline again
+    void clear() {
+        destroy_inline();
+        table_.release_slots();
+    }
+
+    std::pair<iterator, bool> insert(const value_type &value) {
+        return emplace(value);
+    }
+
+    std::pair<iterator, bool> insert(value_type &&value) {
+        return emplace(std::move(value));
+    }
+
+    iterator insert(const_iterator, const value_type &value) {
+        return emplace(value).first;
+    }
+
+    iterator insert(const_iterator, value_type &&value) {
+        return emplace(std::move(value)).first;
+    }
+
+    template<class InputIt>
+    void insert(InputIt first, InputIt last) {
+        for (auto i = first; i != last; ++i) {
+            emplace(*i);
+        }
+    }
+
+    void insert(std::initializer_list<value_type> init) {
+        for (const auto &i: init) {
+            emplace(i);
+        }
+    }
+
+    // batches only pay off once the table is hashed; what fits inline is
+    // inserted one by one
+    template<std::forward_iterator It>
+    void insert_batch(It first, It last) {
+        for (; first != last && !spilled(); ++first) {
+            emplace(*first);
+        }
+        if (first != last) {
+            table_.insert_batch(first, last);
+        }
+    }
+
+    // inline elements are written as the table they would have spilled into
+    void save(std::ostream &out) const requires requires(const Table &t) { t.save(out); } {
+        if (spilled()) {
+            table_.save(out);
+        } else {
+            hashed_copy().save(out);
+        }
+    }
+
+    template<std::random_access_iterator It>
+    void parallel_insert(It first, It last, size_type threads = 0) {
+        size_type n = last - first;
+        if (!spilled() && size_ + n > N) {
+            spill(size_ + n);
+        }
+        if (spilled()) {
+            table_.parallel_insert(first, last, threads);
+        } else {
+            insert(first, last);
+        }
+    }
+
+    template<class F>
+    void parallel_for_each(F &&f, size_type threads = 0) {
+        parallel_for_each_impl(*this, f, threads);
+    }
+
+    template<class F>
+    void parallel_for_each(F &&f, size_type threads = 0) const {
+        parallel_for_each_impl(*this, f, threads);
+    }
+
+    template<class... Args>
+    std::pair<iterator, bool> emplace(Args &&... args) {
+        if constexpr (sizeof...(Args) == 1 && (std::is_same_v<std::remove_cvref_t<Args>, value_type> && ...)) {
+            return emplace_key(table_.key_of_(args)..., std::forward<Args>(args)...);
+        } else {
+            typename Table::Holder tmp(table_.alloc_, std::forward<Args>(args)...);
+            const auto &key = table_.key_of_(tmp.value());
+            return insert_with(key, table_.hash_of(key), [&](slot_type &slot) {
+                tmp.move_to(slot);
+            });
+        }
+    }
+
+    template<class K, class... Args>
+    std::pair<iterator, bool> emplace_key(const K &key, Args &&... args) {
+        return insert_with(key, table_.hash_of(key), [&](slot_type &slot) {
+            slot.construct(table_.alloc_, std::forward<Args>(args)...);
+        });
+    }
+
+    template<class... Args>
+    iterator emplace_hint(const_iterator, Args &&... args) {
+        return emplace(std::forward<Args>(args)...).first;
+    }
+
+    iterator erase(const_iterator pos) {
+        if (spilled()) {
+            return table_.erase(pos);
+        }
+        size_type id = index_of(pos);
+        erase_at(id);
+        return inline_from(id + 1);
+    }
+
+    iterator erase(const_iterator first, const_iterator last) {
+        if (spilled()) {
+            return table_.erase(first, last);
+        }
+        for (; first != last; ++first) {
+            erase_at(index_of(first));
+        }
+        return inline_from(index_of(last));
+    }
+
+    size_type erase(const key_type &key) {
+        return erase_key(key);
+    }
+
+    template<class K>
+    requires (transparent_lookup && !std::is_convertible_v<K, iterator> && !std::is_convertible_v<K, const_iterator>)
+    size_type erase(K &&key) {
+        return erase_key(key);
+    }
+
+    template<class Pred>
+    size_type erase_if(Pred &&pred) {
+        if (spilled()) {
+            return table_.erase_if(pred);
+        }
+        size_type removed = 0;
+        for (size_type i = 0; i < N; ++i) {
+            if (is_full(ctrl_[i]) && pred(*slots_[i].get())) {
+                erase_at(i);
+                ++removed;
+            }
+        }
+        return removed;
+    }
+
+    node_type extract(const_iterator pos) {
+        if (spilled()) {
+            return table_.extract(pos);
+        }
+        size_type id = index_of(pos);
+        node_type node = table_.release_cell(slots_[id]);
+        free_at(id);
+        return node;
+    }
+
+    node_type extract(const key_type &key) {
+        return extract_key(key);
+    }
+
+    template<class K>
+    requires (transparent_lookup && !std::is_convertible_v<K, iterator> && !std::is_convertible_v<K, const_iterator>)
+    node_type extract(K &&key) {
+        return extract_key(key);
+    }
+
+    insert_return_type insert(node_type &&node) {
+        if (node.empty()) {
+            return {end(), false, node_type()};
+        }
+        auto [it, inserted] = insert_with(table_.key_of_(node.value()), table_.node_hash(node),
+                                          [&](slot_type &to) {
+                                              table_.adopt_node(node, to);
+                                          });
+        if (!inserted) {
+            return {it, false, std::move(node)};
+        }
+        return {it, true, node_type()};
+    }
+
+    // see HashTable::merge; between two hashed tables it is that merge
+    void merge(SmallHashTable &source) {
+        if (&source == this || source.empty()) {
+            return;
+        }
+        reserve(size() + source.size());
+        if (spilled() && source.spilled()) {
+            table_.merge(source.table_);
+        } else if (!source.spilled()) {
+            for (size_type i = 0; i < N; ++i) {
+                if (is_full(source.ctrl_[i])) {
+                    take(source, source.inline_at(i));
+                }
+            }
+        } else {
+            // everything fits inline here; the loop is that of HashTable::merge
+            Table &src = source.table_;
+            for (size_type i = src.first_full_; i < src.bucket_count();) {
+                if (!is_full(src.ctrl_[i])) {
+                    i = src.next_full(i);
+                } else if (!take(source, src.iterator_at(i)).second || !Table::robin_hood_) {
+                    ++i;
+                }
+            }
+        }
+    }
+
+    void merge(SmallHashTable &&source) {
+        merge(source);
+    }
+
+    // exchanges the contents of the container with those of other;
+    // inline elements are moved, heap slots change hands
+    void swap(SmallHashTable &&other) noexcept(nothrow_relocate_) {
+        if constexpr (!nothrow_relocate_) {
+            // parked in two tables of their own, each element is in exactly one
+            // table whenever a move throws, and no hashed table holds any
+            SmallHashTable mine(slot_less(*this, get_allocator())), theirs(slot_less(other, other.get_allocator()));
+            move_inline(*this, mine);
+            move_inline(other, theirs);
+            table_.swap(std::move(other.table_));
+            move_inline(theirs, *this);
+            move_inline(mine, other);
+            return;
+        }
+        table_.swap(std::move(other.table_));
+        for (size_type i = 0; i < N; ++i) {
+            bool mine = is_full(ctrl_[i]);
+            bool theirs = is_full(other.ctrl_[i]);
+            if (mine && theirs) {
+                slot_type tmp;
+                tmp.relocate(table_.alloc_, slots_[i]);
+                slots_[i].relocate(table_.alloc_, other.slots_[i]);
+                other.slots_[i].relocate(other.table_.alloc_, tmp);
+            } else if (mine) {
+                other.slots_[i].relocate(other.table_.alloc_, slots_[i]);
+            } else if (theirs) {
+                slots_[i].relocate(table_.alloc_, other.slots_[i]);
+            }
+        }
+        std::swap(ctrl_, other.ctrl_);
+        std::swap(size_, other.size_);
+    }
+
+    size_type count(const key_type &key) const {
+        return contains(key) ? 1 : 0;
+    }
+
+    template<class K>
+    requires transparent_lookup
+    size_type count(const K &key) const {
+        return contains(key) ? 1 : 0;
+    }
+
+    iterator find(const key_type &key) {
+        return find_impl(*this, key);
+    }
+
+    const_iterator find(const key_type &key) const {
+        return find_impl(*this, key);
+    }
+
+    template<class K>
+    requires transparent_lookup
+    iterator find(const K &key) {
+        return find_impl(*this, key);
+    }
+
+    template<class K>
+    requires transparent_lookup
+    const_iterator find(const K &key) const {
+        return find_impl(*this, key);
+    }
+
+    // inline lookups touch no memory outside the table, so they are not batched
+    template<std::forward_iterator It, class Found>
+    void find_batch(It first, It last, Found &&found) {
+        find_batch_impl(*this, first, last, found);
+    }
+
+    template<std::forward_iterator It, class Found>
+    void find_batch(It first, It last, Found &&found) const {
+        find_batch_impl(*this, first, last, found);
+    }
+
+    bool contains(const key_type &key) const {
+        return find(key) != end();
+    }
+
+    template<class K>
+    requires transparent_lookup
+    bool contains(const K &key) const {
+        return find(key) != end();
+    }
+
+    std::pair<iterator, iterator> equal_range(const key_type &key) {
+        return equal_range_impl(*this, key);
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(const key_type &key) const {
+        return equal_range_impl(*this, key);
+    }
+
+    template<class K>
+    requires transparent_lookup
+    std::pair<iterator, iterator> equal_range(const K &key) {
+        return equal_range_impl(*this, key);
+    }
+
+    template<class K>
+    requires transparent_lookup
+    std::pair<const_iterator, const_iterator> equal_range(const K &key) const {
+        return equal_range_impl(*this, key);
+    }
+
+    // the inline buffer counts as N buckets
+    size_type bucket_count() const {
+        return spilled() ? table_.bucket_count() : N;
+    }
+
+    size_type max_bucket_count() const {
+        return table_.max_bucket_count();
+    }
+
+    size_type bucket_size(const size_type) const {
+        return 1;
+    }
+
+    // inline elements have no home, they are all scanned at once
+    size_type bucket(const key_type &key) const {
+        return spilled() ? table_.bucket(key) : 0;
+    }
+
+    float load_factor() const {
+        return size() * 1. / bucket_count();
+    }
+
+    float max_load_factor() const {
+        return table_.max_load_factor();
+    }
+
+    void max_load_factor(float ml) {
+        table_.max_load_factor(ml);
+    }
+
+    // rehashing inline elements is a no-op unless `count` buckets don't fit
+    // in the buffer, in which case they spill
+    void rehash(size_type count) {
+        if (spilled()) {
+            table_.rehash(count);
+        } else if (count > N) {
+            spill_to(std::max(Table::capacity_for_buckets(count), table_.capacity_for(size_ + 1)));
+        }
+    }
+
+    void reserve(size_type count) {
+        if (spilled()) {
+            table_.reserve(count);
+        } else if (count > N) {
+            spill(count);
+        }
+    }
+
+    // inline lookups scan one buffer, a probe length of one for every element
+    HashTableStats stats() const requires StatsPolicy::enabled {
+        if (spilled()) {
+            return table_.stats();
+        }
+        HashTableStats res;
+        res.size = size_;
+        res.bucket_count = N;
+        res.load_factor = load_factor();
+        if (size_ != 0) {
+            res.probe_lengths = {size_};
+            res.longest_probe = 1;
+            res.mean_probe = 1;
+        }
+        res.rehash_count = table_.stats_.rehash_count;
+        res.rehash_time = table_.stats_.rehash_time;
+        return res;
+    }
+
+    // see HashTable::fingerprint; summed up on demand for inline elements
+    size_type fingerprint() const {
+        if (spilled()) {
+            return table_.fingerprint();
+        }
+        size_type res = 0;
+        for (size_type i = 0; i < N; ++i) {
+            if (is_full(ctrl_[i])) {
+                res += Table::print_of(table_.stored_hash(slots_[i]));
+            }
+        }
+        return res;
+    }
+
+    friend bool operator==(const SmallHashTable &lhs, const SmallHashTable &rhs) {
+        if (lhs.spilled() && rhs.spilled()) {
+            return lhs.table_ == rhs.table_;
+        }
+        if (lhs.size() != rhs.size()) return false;
+        if constexpr (std::is_empty_v<hasher>) {
+            if (lhs.fingerprint() != rhs.fingerprint()) return false;
+        }
+        for (auto const &el: lhs) {
+            auto it = rhs.find(lhs.key_of(el));
+            if (it == rhs.end() || !same_value(el, *it)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    friend bool operator!=(const SmallHashTable &lhs, const SmallHashTable &rhs) {
+        return !(lhs == rhs);
+    }
+
+private:
+    static constexpr size_type npos = Table::npos;
+    // whole groups, so that matching never reads past the buffer; the bytes
+    // past N stay free
+    static constexpr size_type ctrl_count_ = (N + Group::width - 1) / Group::width * Group::width;
+
+    template<class>
+    friend struct SetAlgebra;
+
+    explicit SmallHashTable(Table &&table) : table_(std::move(table)) {}
+
+    static constexpr std::array<ctrl_t, ctrl_count_> free_ctrl() {
+        std::array<ctrl_t, ctrl_count_> res;
+        res.fill(CTRL_FREE);
+        return res;
+    }
+
+    bool spilled() const noexcept {
+        return table_.bucket_count() != 0;
+    }
+
+    iterator inline_at(size_type id) {
+        return iterator(ctrl_.data() + id, ctrl_.data() + N, slots_ + id);
+    }
+
+    const_iterator inline_at(size_type id) const {
+        return const_iterator(ctrl_.data() + id, ctrl_.data() + N, slots_ + id);
+    }
+
+    // first element at or after inline slot `id`, or end()
+    iterator inline_from(size_type id) {
+        return inline_at(next_full_ctrl(ctrl_.data() + id, ctrl_.data() + N) - ctrl_.data());
+    }
+
+    const_iterator inline_from(size_type id) const {
+        return inline_at(next_full_ctrl(ctrl_.data() + id, ctrl_.data() + N) - ctrl_.data());
+    }
+
+    size_type index_of(const_iterator it) const {
+        return Table::ctrl_of(it) - ctrl_.data();
+    }
+
+    // inline slot holding `key` or npos; the fragments of all inline
+    // elements are compared in one go, and only matches compare keys
+    template<class K>
+    size_type find_inline(const K &key, size_type hash) const {
+        ctrl_t h2 = IndexPolicy::fragment(hash);
+        for (size_type g = 0; g < ctrl_count_; g += Group::width) {
+            for (size_type i: Group(ctrl_.data() + g).match(h2)) {
+                // the portable group may report a false match next to a real one
+                if (g + i < N && table_.holds(slots_[g + i], key, hash)) {
+                    return g + i;
+                }
+            }
+        }
+        return npos;
+    }
+
+    // lowest free inline slot, there must be one
+    size_type free_inline() const {
+        for (size_type g = 0;; g += Group::width) {
+            auto mask = Group(ctrl_.data() + g).match_free();
+            if (mask) {
+                return g + mask.lowest();
+            }
+        }
+    }
+
+    // inline slot `id` was just filled with an element whose control byte
+    // is `ctrl`, and whose hash is that of `from` if hashes are cached
+    void occupy(size_type id, ctrl_t ctrl, const slot_type &from) {
+        if constexpr (Table::cached_hash_) {
+            slots_[id].set_hash(from.hash());
+        }
+        ctrl_[id] = ctrl;
+        ++size_;
+    }
+
+    void free_at(size_type id) noexcept {
+        ctrl_[id] = CTRL_FREE;
+        --size_;
+    }
+
+    void erase_at(size_type id) noexcept {
+        slots_[id].destroy(table_.alloc_);
+        free_at(id);
+    }
+
+    void destroy_inline() noexcept {
+        if constexpr (!slot_type::trivial_destroy) {
+            for (size_type i = 0; i < N; ++i) {
+                if (is_full(ctrl_[i])) {
+                    slots_[i].destroy(table_.alloc_);
+                }
+            }
+        }
+        forget_inline();
+    }
+
+    // inline elements were moved out
+    void forget_inline() noexcept {
+        ctrl_.fill(CTRL_FREE);
+        size_ = 0;
+    }
+
+    // moves the inline elements of `from` into the same slots of `to`, whose
+    // buffer is empty
+    static void move_inline(SmallHashTable &from, SmallHashTable &to) noexcept(nothrow_relocate_) {
+        for (size_type i = 0; i < N; ++i) {
+            if (is_full(from.ctrl_[i])) {
+                to.slots_[i].relocate(to.table_.alloc_, from.slots_[i]);
+                to.occupy(i, from.ctrl_[i], to.slots_[i]);
+                from.free_at(i);
+            }
+        }
+    }
+
+    // empty inline table with the functors of `o`
+    static SmallHashTable slot_less(const SmallHashTable &o, const allocator_type &alloc) {
+        Table res(typename Table::no_slots_t(), o.table_.hash_, o.table_.equal_, o.table_.key_of_, alloc);
+        res.max_load_factor_ = o.table_.max_load_factor_;
+        return SmallHashTable(std::move(res));
+    }
+
+    // moves the element in inline slot `id` of `src` into the empty slot `to`,
+    // see HashTable::adopt_slot
+    void adopt(SmallHashTable &src, size_type id, slot_type &to) {
+        if constexpr (!Table::table_owned_nodes_) {
+            if (table_.alloc_ == src.table_.alloc_) {
+                to.relocate(table_.alloc_, src.slots_[id]);
+                return;
+            }
+        }
+        to.construct(table_.alloc_, std::move(*src.slots_[id].get()));
+        src.slots_[id].destroy(src.table_.alloc_);
+    }
+
+    // moves the inline elements into heap slots with room for `count` elements
+    void spill(size_type count) {
+        spill_to(table_.capacity_for(std::max(count, size_)));
+    }
+
+    void spill_to(size_type buckets) {
+        typename Table::RehashScope scope(table_.stats_);
+        table_.allocate(buckets);
+        for (size_type i = 0; i < N; ++i) {
+            if (is_full(ctrl_[i])) {
+                size_type hash = table_.stored_hash(slots_[i]);
+                size_type id = table_.prepare_insert_or_grow(hash);
+                table_.slots_[id].relocate(table_.alloc_, slots_[i]);
+                table_.occupy(id, hash);
+            }
+        }
+        forget_inline();
+    }
+
+    // probes once for `key`, see HashTable::insert_with; the table spills
+    // when the element would not fit inline
+    template<class K, class Fill>
+    std::pair<iterator, bool> insert_with(const K &key, size_type hash, Fill &&fill) {
+        if (!spilled()) {
+            size_type id = find_inline(key, hash);
+            if (id != npos) {
+                return {inline_at(id), false};
+            }
+            if (size_ < N) {
+                id = free_inline();
+                fill(slots_[id]);
+                if constexpr (Table::cached_hash_) {
+                    slots_[id].set_hash(hash);
+                }
+                ctrl_[id] = IndexPolicy::fragment(hash);
+                ++size_;
+                return {inline_at(id), true};
+            }
+            spill(N + 1);
+        }
+        auto [id, inserted] = table_.insert_with(key, hash, std::forward<Fill>(fill));
+        return {table_.iterator_at(id), inserted};
+    }
+
+    template<class K>
+    size_type erase_key(const K &key) {
+        if (spilled()) {
+            return table_.erase(key);
+        }
+        size_type id = find_inline(key, table_.hash_of(key));
+        if (id == npos) {
+            return 0;
+        }
+        erase_at(id);
+        return 1;
+    }
+
+    template<class K>
+    node_type extract_key(const K &key) {
+        auto it = find(key);
+        return it == end() ? node_type() : extract(it);
+    }
+
+    template<class Self, class K>
+    static auto find_impl(Self &self, const K &key) {
+        if (self.spilled()) {
+            return self.table_.find(key);
+        }
+        size_type id = self.find_inline(key, self.table_.hash_of(key));
+        return self.inline_at(id == npos ? N : id);
+    }
+
+    template<class Self, class It, class Found>
+    static void find_batch_impl(Self &self, It first, It last, Found &found) {
+        if (self.spilled()) {
+            self.table_.find_batch(first, last, found);
+            return;
+        }
+        for (; first != last; ++first) {
+            found(find_impl(self, *first));
+        }
+    }
+
+    template<class Self, class K>
+    static auto equal_range_impl(Self &self, const K &key) {
+        auto it = find_impl(self, key);
+        return std::make_pair(it, it == self.end() ? it : std::next(it));
+    }
+
+    template<class Self, class F>
+    static void parallel_for_each_impl(Self &self, F &f, size_type threads) {
+        if (self.spilled()) {
+            self.table_.parallel_for_each(f, threads);
+            return;
+        }
+        for (auto &el: self) {
+            f(el);
+        }
+    }
+
+    // the table the inline elements would spill into, for save()
+    Table hashed_copy() const {
+        Table res(typename Table::no_slots_t(), table_.hash_, table_.equal_, table_.key_of_, get_allocator());
+        res.max_load_factor_ = table_.max_load_factor_;
+        res.allocate(res.capacity_for(size_));
+        for (size_type i = 0; i < N; ++i) {
+            if (is_full(ctrl_[i])) {
+                size_type hash = table_.stored_hash(slots_[i]);
+                size_type id = res.prepare_insert_or_grow(hash);
+                res.slots_[id].construct(res.alloc_, *slots_[i].get());
+                res.occupy(id, hash);
+            }
+        }
+        return res;
+    }
+
+    const auto &key_of(const value_type &value) const {
+        return table_.key_of(value);
+    }
+
+    static bool same_value(const value_type &a, const value_type &b) {
+        return Table::same_value(a, b);
+    }
+
+    static SmallHashTable empty_like(const SmallHashTable &o, size_type count, const allocator_type &alloc) {
+        if (count > N) {
+            return SmallHashTable(Table::empty_like(o.table_, count, alloc));
+        }
+        return slot_less(o, alloc);
+    }
+
+    static SmallHashTable copy_like(const SmallHashTable &o, size_type count, const allocator_type &alloc) {
+        if (o.spilled()) {
+            return SmallHashTable(Table::copy_like(o.table_, count, alloc));
+        }
+        SmallHashTable res(o, alloc);
+        res.reserve(count);
+        return res;
+    }
+
+    // see HashTable::take; `pos` is looked up here first, so that it is
+    // only extracted to be inserted
+    std::pair<iterator, bool> take(SmallHashTable &src, const_iterator pos) {
+        auto it = find(key_of(*pos));
+        if (it != end()) {
+            return {it, false};
+        }
+        return {insert(src.extract(pos)).position, true};
+    }
+
+    // slot-less while the elements are inline; holds the hasher, key_equal
+    // and allocator for them as well
+    Table table_;
+    size_type size_ = 0;
+    std::array<ctrl_t, ctrl_count_> ctrl_ = free_ctrl();
+    slot_type slots_[N];
+};
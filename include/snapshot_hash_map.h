@@ -0,0 +1,200 @@
+#pragma once
+
+#include "hash_map.h"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// HashMap for data written rarely and read all the time from every thread.
+// Readers see an immutable snapshot; writers copy it, change the copy and
+// publish it with one atomic store, then wait until no reader can still be
+// looking at the old snapshot before freeing it (epoch based reclamation).
+// A read does no read-modify-write and writes nothing shared: it only
+// announces the epoch it entered in its Reader's own cache line, so readers
+// on different cores never bounce a cache line between each other.
+// Every update copies the whole map, so changes should be batched into one
+// update() where possible
+template<
+        class Key,
+        class T,
+        class CollisionPolicy = LinearProbing,
+        class Hash = std::hash<Key>,
+        class Equal = std::equal_to<Key>,
+        class Storage = default_storage_t<Key, Hash>,
+        class IndexPolicy = PowerOfTwoMasking
+>
+class SnapshotHashMap {
+public:
+    using map_type = HashMap<Key, T, CollisionPolicy, Hash, Equal, Storage, IndexPolicy>;
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = typename map_type::value_type;
+    using size_type = std::size_t;
+
+private:
+    static constexpr std::uint64_t idle_ = std::numeric_limits<std::uint64_t>::max();
+
+    // epoch a reader entered its read section in, or idle_ outside of one
+    struct alignas(64) Slot {
+        std::atomic<std::uint64_t> epoch{idle_};
+        bool taken = true;
+    };
+
+public:
+    // a thread's handle for reading the map: owns a slot the writers check
+    // before freeing a snapshot; it must not outlive the map, nor be shared
+    // between threads
+    class Reader {
+    private:
+        const SnapshotHashMap *owner_;
+        Slot *slot_;
+        int depth_ = 0;
+
+        friend SnapshotHashMap;
+
+        Reader(const SnapshotHashMap *owner, Slot *slot) : owner_(owner), slot_(slot) {}
+
+        // leaves the read section even if the visitor throws
+        struct Section {
+            Reader &reader;
+
+            ~Section() {
+                if (--reader.depth_ == 0) {
+                    reader.slot_->epoch.store(idle_, std::memory_order_release);
+                }
+            }
+        };
+
+    public:
+        Reader(const Reader &) = delete;
+
+        Reader &operator=(const Reader &) = delete;
+
+        Reader(Reader &&other) noexcept: owner_(other.owner_), slot_(std::exchange(other.slot_, nullptr)) {}
+
+        ~Reader() {
+            if (slot_ != nullptr) {
+                owner_->release(slot_);
+            }
+        }
+
+        // calls `f(const map_type &)` with the current snapshot, which stays
+        // alive until `f` returns; nested calls on the same reader are fine
+        template<class F>
+        decltype(auto) read(F &&f) {
+            if (depth_++ == 0) {
+                slot_->epoch.store(owner_->epoch_.load(std::memory_order_acquire), std::memory_order_relaxed);
+                // the announcement must be visible before the snapshot is loaded
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+            Section section{*this};
+            return std::forward<F>(f)(*owner_->current_.load(std::memory_order_acquire));
+        }
+
+        bool contains(const key_type &key) {
+            return read([&](const map_type &map) { return map.contains(key); });
+        }
+
+        // calls `f(const value_type &)` on the element with `key` if there is one
+        template<class F>
+        bool visit(const key_type &key, F &&f) {
+            return read([&](const map_type &map) {
+                auto it = map.find(key);
+                if (it == map.end()) {
+                    return false;
+                }
+                f(*it);
+                return true;
+            });
+        }
+    };
+
+    SnapshotHashMap() : SnapshotHashMap(map_type()) {}
+
+    explicit SnapshotHashMap(map_type map) : current_(new map_type(std::move(map))) {}
+
+    SnapshotHashMap(const SnapshotHashMap &) = delete;
+
+    SnapshotHashMap &operator=(const SnapshotHashMap &) = delete;
+
+    // all readers must be gone by now
+    ~SnapshotHashMap() {
+        delete current_.load(std::memory_order_relaxed);
+    }
+
+    Reader reader() const {
+        std::lock_guard lock(writer_lock_);
+        for (Slot &slot: slots_) {
+            if (!slot.taken) {
+                slot.taken = true;
+                return Reader(this, &slot);
+            }
+        }
+        return Reader(this, &slots_.emplace_back());
+    }
+
+    // publishes a copy of the current snapshot changed by `f(map_type &)`;
+    // updates are serialized, and each returns once the previous snapshot is
+    // freed, so a thread must not update from inside its own read()
+    template<class F>
+    void update(F &&f) {
+        std::lock_guard lock(writer_lock_);
+        auto next = std::make_unique<map_type>(*current_.load(std::memory_order_relaxed));
+        std::forward<F>(f)(*next);
+        publish(next.release());
+    }
+
+    // replaces the whole content, without copying the current snapshot
+    void assign(map_type map) {
+        std::lock_guard lock(writer_lock_);
+        publish(new map_type(std::move(map)));
+    }
+
+    template<class M>
+    void insert_or_assign(const key_type &key, M &&value) {
+        update([&](map_type &map) { map.insert_or_assign(key, std::forward<M>(value)); });
+    }
+
+    size_type erase(const key_type &key) {
+        size_type res = 0;
+        update([&](map_type &map) { res = map.erase(key); });
+        return res;
+    }
+
+    size_type size() const {
+        std::lock_guard lock(writer_lock_);
+        return current_.load(std::memory_order_relaxed)->size();
+    }
+
+private:
+    // under writer_lock_
+    void publish(map_type *next) {
+        map_type *old = current_.exchange(next, std::memory_order_seq_cst);
+        std::uint64_t epoch = epoch_.load(std::memory_order_relaxed) + 1;
+        epoch_.store(epoch, std::memory_order_seq_cst);
+        // readers that entered before the new epoch may still hold `old`
+        for (Slot &slot: slots_) {
+            while (slot.epoch.load(std::memory_order_seq_cst) < epoch) {
+                std::this_thread::yield();
+            }
+        }
+        delete old;
+    }
+
+    void release(Slot *slot) const {
+        std::lock_guard lock(writer_lock_);
+        slot->taken = false;
+    }
+
+    std::atomic<map_type *> current_;
+    std::atomic<std::uint64_t> epoch_{0};
+    mutable std::mutex writer_lock_;
+    // never moved once created, readers keep pointers to them
+    mutable std::deque<Slot> slots_;
+};
@@ -1,9 +1,21 @@
 #include "randomized_queue.h"
+#include "concurrent_randomized_queue.h"
 #include "hash_map.h"
 #include "hash_set.h"
+#include "concurrent_hash_map.h"
+#include "snapshot_hash_map.h"
+#include "mapped_hash_table.h"
+#include "sentinel_hash_map.h"
+#include "frozen_hash_table.h"
 int main() {
     randomized_queue<char> a;
+    concurrent_randomized_queue<char> shared;
     HashMap<int, int> map;
     HashSet<int> set;
+    ConcurrentHashMap<int, int> concurrent;
+    SnapshotHashMap<int, int> snapshot;
+    SentinelHashMap<int, int, 0, -1> sentinel;
+    constexpr auto frozen = make_frozen_map<int, int>({{1, 2}, {3, 4}});
+    static_assert(frozen.at(3) == 4);
     return 0;
 }
\ No newline at end of file